@@ -1,8 +1,27 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <float.h>
+#include <limits.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "flows_export.h"
 
 /** Flows v1LRS.1 (version with local range storing)
  *  Created by Daniil Didenko
@@ -11,7 +30,13 @@
  *  *   *   *   *   *   *   *   USAGE   *   *   *   *   *   *   *   *   *
  *                                                                      *
  *  cc -std=c11 -Wall -Wextra -Werror -pedantic flows.c -o flows -lm    *
- *  $ ./flows FILENAME N WB WT WD WS                                    *
+ *     -pthread                                                         *
+ *  $ ./flows FILENAME N WB WT WD WS [OPTIONS]                          *
+ *  $ ./flows FILENAME N --weights-file WEIGHTS [OPTIONS]               *
+ *  $ ./flows knn FILENAME K [FLOWID...] [OPTIONS]                      *
+ *  $ ./flows batch MANIFEST [OPTIONS]                                  *
+ *  $ ./flows verify [CASES] [SEED] [OPTIONS]                          *
+ *  $ ./flows stream N WB WT WD WS [OPTIONS] < RECORDS                  *
  *                                                                      *
  *  *   *   *   *   *   *   *   *   *   *   *   *   *   *   *   *   *   *
  *
@@ -22,6 +47,29 @@
  *  @param WD - Weight for averageInterTime.
  *  @param WS - Weight for averageInterLength
  *
+ *  OPTIONS:
+ *  --max-distance D - Stops uniting when closest pair is farther than D
+ *  --engine NAME    - Uniting engine: reference (default), mst or mnn
+ *  --weights WB,WT,WD,WS - Weights for knn mode (all 1 by default)
+ *  --window W       - Clusters every W consecutive flows (sliding window)
+ *  --step S         - Flows entering and leaving window in one step (W by default)
+ *  --partition-by P - Clusters flows of every subnet separately (src/24, dst/16, pair, ...)
+ *  --compact KIND   - Compact features for mnn search: float or fixed16 (same result)
+ *  --cluster-stats  - Prints count, merge height and sum/mean/min/max of features per cluster
+ *  --export PATH    - Writes result in binary form to file or shm:/NAME (see flows_export.h)
+ *  --export-merges  - Adds merges with their ranges to export
+ *  --weights-file F - Clusters flows once for every "WB WT WD WS" line of F
+ *  --placement P    - Large buffers: default, interleave or first-touch, with /thp or /hugetlb pages
+ *  --threads T      - Worker threads shared by all parallel parts (all processors by default)
+ *  --stats          - Prints per-worker tasks, steals, busy time and search counters to stderr
+ *  --approx EPS     - Clusters representatives of EPS wide grid cells and gives flows their clusters
+ *  --trace FILE     - Writes parse, distance block, merge and output events as Chrome trace JSON
+ *                     (program has to be compiled with -DFLOWS_TRACE, probes are empty otherwise)
+ *  --memory-limit M - Memory for summary of stream mode in bytes, with K, M or G suffix (1M by default)
+ *
+ *  Stream mode reads flow lines without count from stdin and keeps only their summary,
+ *  clusters are printed at end of input and every time program gets SIGUSR1.
+ *
  */
 
 //program stages written in text for easier use
@@ -34,9 +82,22 @@ enum programStage
     afterRead
 };
 
+//engines which can be used for uniting clusters
+enum clusteringEngine
+{
+    referenceEngine,
+    spanningTreeEngine,
+    nearestRoundsEngine
+};
+
+// range from cluster to other cluster, clusters are identified by their indexes in storage
+// when ranges were calculated, so united clusters keep ranges of all their original clusters
 typedef struct SRange
 {
-    int flowID;
+    // original cluster at the other end of range
+    int clusterInx;
+    // original cluster of this cluster which is at the near end of range
+    int memberInx;
     double range;
 }Range;
 
@@ -46,10 +107,23 @@ typedef struct SFlow
     int flowID;
     int totalBytes;
     int flowDuration;
+    // position of flow in input file
+    int inputInx;
     double avgInterTime;
     double avgInterLength;
 }Flow;
 
+// structure for storing aggregates of cluster's flows, they are updated in O(1) on every merge
+typedef struct SClusterStats
+{
+    // sums, minimums and maximums of features in order of their axes
+    double sums[4];
+    double mins[4];
+    double maxs[4];
+    // range of the last merge which formed cluster, 0 for single flows
+    double mergeHeight;
+}ClusterStats;
+
 // structure for storing all clusters flows as well as flow's count for more convenient use
 typedef struct SCluster
 {
@@ -57,6 +131,8 @@ typedef struct SCluster
     int rangeCount;
     Range* ranges;
     Flow* flows;
+    // NULL if stats are not collected, so clusters stay small when they are moved by sorts
+    ClusterStats* stats;
 }Cluster;
 
 // structure for storing all clusters as well as cluster count for more convenient use in functions
@@ -76,9 +152,356 @@ typedef struct SWeights
     double interLength;
 }Weights;
 
+// structure for storing edge of minimum spanning tree between 2 clusters in storage
+typedef struct SEdge
+{
+    int clusterA;
+    int clusterB;
+    double range;
+}Edge;
+
+// structure for storing shared state of one round of nearest neighbour engine
+typedef struct SNeighbourRound
+{
+    Flow* flows;
+    int flowCount;
+    Weights weights;
+    // flows ordered by feature with the biggest weight, so search can stop
+    // as soon as projection on it is farther than best range found
+    int* order;
+    // features of ordered flows, 4 for every flow from the biggest weight
+    double* sortedFeatures;
+    double sortedWeights[4];
+    // optional compact copy of sorted features scaled by square roots of weights,
+    // search runs on it and only candidates which can be nearest are checked exactly
+    int compactKind;
+    float* compactFloats;
+    int16_t* compactFixed;
+    // value of one fixed16 unit on every axis
+    double compactSteps[4];
+    // biggest error of compact difference on first axis and of whole compact range
+    double axisError;
+    double rangeError;
+    // union-find array shared by all threads
+    _Atomic int* parent;
+    // root of every flow at start of round
+    int* component;
+    // shortest edge from every flow to other component
+    Edge* shortest;
+    // shortest edges of components which should be added in this round
+    Edge* candidates;
+    int candidateCount;
+    // edges of spanning tree found so far
+    Edge* edges;
+    _Atomic int edgeCount;
+}NeighbourRound;
+
+// structure for counting unfinished tasks of one parallel loop
+typedef struct STaskGroup
+{
+    _Atomic int pending;
+}TaskGroup;
+
+// structure for storing part of parallel loop, which can be split or stolen by other worker
+typedef struct STask
+{
+    void (*body)(void* context, int begin, int end);
+    void* context;
+    int begin;
+    int end;
+    // parts which are not bigger are not split anymore
+    int grain;
+    TaskGroup* group;
+}Task;
+
+// structure for storing tasks of one worker, owner pushes and pops them at bottom,
+// other workers steal them from top without locks (Chase-Lev deque)
+typedef struct STaskDeque
+{
+    _Atomic long top;
+    _Atomic long bottom;
+    // capacity is power of 2
+    _Atomic(Task*)* slots;
+    long capacity;
+}TaskDeque;
+
+// structure for storing statistics of one worker
+typedef struct SWorkerStats
+{
+    long taskCount;
+    long stealCount;
+    long stealAttempts;
+    double busySeconds;
+    // ranges of nearest neighbour search which were calculated whole,
+    // abandoned after part of their terms and skipped by projection bound
+    long fullRangeCount;
+    long abandonedRangeCount;
+    long skippedRangeCount;
+}WorkerStats;
+
+// structure for storing pool of workers shared by all parallel parts of program
+typedef struct SScheduler
+{
+    // calling thread is worker 0, so only threads from index 1 are created
+    int threadCount;
+    pthread_t* threads;
+    TaskDeque* deques;
+    WorkerStats* stats;
+    bool isPinned;
+    double startTime;
+    _Atomic bool isStopping;
+    // changes every time task is pushed, so workers going to sleep do not miss it
+    _Atomic long generation;
+    _Atomic int sleepingCount;
+    pthread_mutex_t sleepLock;
+    pthread_cond_t wakeUp;
+}Scheduler;
+
+// structure for storing merges of clusters in order they were done
+typedef struct SMergeLog
+{
+    // NULL means that merges are not recorded
+    FlowsExportMerge* merges;
+    int mergeCount;
+    int capacity;
+}MergeLog;
+
+// size of huge page and limits used for placing large buffers
+#define PLACEMENT_HUGE_PAGE ((size_t)2*1024*1024)
+#define PLACEMENT_MAX_NODES 128
+#define PLACEMENT_SAMPLES 256
+// MPOL_INTERLEAVE mode of mbind (linux/mempolicy.h)
+#define PLACEMENT_MPOL_INTERLEAVE 3
+
+// structure for storing one buffer allocated by allocateLarge
+typedef struct SLargeBuffer
+{
+    void* data;
+    size_t size;
+    // size of mapping, 0 if buffer was allocated by malloc
+    size_t mappedSize;
+    bool isHugeTlb;
+    const char* name;
+}LargeBuffer;
+
+// structure for storing policy of large buffers, buffers which were not released yet
+// and statistics of placement of released ones
+typedef struct SPlacement
+{
+    int policy;
+    int pageKind;
+    bool isCollecting;
+    pthread_mutex_t lock;
+    LargeBuffer* buffers;
+    int bufferCount;
+    int capacity;
+    long allocationCount;
+    size_t allocatedBytes;
+    size_t hugeBytes;
+    long hugeTlbFallbacks;
+    long policyFailures;
+    // sampled pages of buffers by node they were placed on
+    long nodePages[PLACEMENT_MAX_NODES];
+    long missingPages;
+    long unknownBuffers;
+}Placement;
+
+// structure for sorting flows by one of their features
+typedef struct SProjectedFlow
+{
+    double projection;
+    int flowInx;
+}ProjectedFlow;
+
+// structure for storing all optional arguments entered after "--"
+typedef struct SOptions
+{
+    // negative value means that uniting is limited only by cluster count
+    double maxDistance;
+    int engine;
+    // weights used by modes which do not take them as positional arguments
+    Weights weights;
+    // 0 means that window mode is not used
+    int windowSize;
+    int windowStep;
+    // flows are clustered separately for every prefix of their addresses
+    int partitionBy;
+    int partitionPrefix;
+    int compactKind;
+    // result is also written in binary form if path is not NULL
+    const char* exportPath;
+    bool exportMerges;
+    bool printClusterStats;
+    // file with weight vectors, flows are clustered with every one of them if it is not NULL
+    const char* weightsFile;
+    // placement of large buffers
+    int placementPolicy;
+    int pageKind;
+    // flows are clustered approximately with grid of this size if it is positive
+    double approxEps;
+    // events are written as Chrome trace JSON if it is not NULL (needs -DFLOWS_TRACE)
+    const char* tracePath;
+    // bytes of nodes of summary in stream mode
+    long memoryLimit;
+    // 0 means all processors available to program
+    int threadCount;
+    bool printStats;
+}Options;
+
+// structure for storing flows of one partition
+typedef struct SPartition
+{
+    uint64_t key;
+    ClusterStorage storage;
+    int result;
+}Partition;
+
+// structure for sharing partitions between clustering tasks
+typedef struct SPartitionJob
+{
+    Partition* partitions;
+    // partitions ordered from biggest, so big ones do not start last
+    int* order;
+    int partitionCount;
+    int destClusterCount;
+    Weights weights;
+    Options options;
+}PartitionJob;
+
+//ways of storing features for nearest neighbour search
+enum compactKind
+{
+    noCompact,
+    floatCompact,
+    fixed16Compact
+};
+
+//policies of placing large buffers on NUMA nodes
+enum placementPolicy
+{
+    defaultPlacement,
+    interleavePlacement,
+    firstTouchPlacement
+};
+
+//kinds of pages backing large buffers
+enum pageKind
+{
+    smallPages,
+    transparentPages,
+    explicitPages
+};
+
+//ways of splitting flows to partitions
+enum partitionKind
+{
+    noPartition,
+    sourcePartition,
+    destinationPartition,
+    pairPartition
+};
+
+//states of job in batch mode
+enum jobState
+{
+    jobWaiting,
+    jobLoaded,
+    jobFailed
+};
+
+// structure for storing one job of batch mode
+typedef struct SBatchJob
+{
+    char* fileName;
+    char* outName;
+    int destClusterCount;
+    Weights weights;
+    // content of source file once it is loaded
+    char* data;
+    size_t size;
+    int state;
+    int result;
+}BatchJob;
+
+// structure for sharing batch jobs between reading and clustering threads
+typedef struct SBatch
+{
+    BatchJob* jobs;
+    int jobCount;
+    Options options;
+    int nextToLoad;
+    int nextToRun;
+    // loaded jobs which were not clustered yet, limited so all files are not in memory at once
+    int loadedCount;
+    int maxLoadedCount;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+}Batch;
+
+// structure for storing spanning tree of flows inside sliding window,
+// flows enter window at its end and leave it at its begin
+typedef struct SWindowTree
+{
+    // all flows in order in which they came
+    Flow* flows;
+    Weights weights;
+    // window covers flows with indexes from begin to end (excluding end)
+    int begin;
+    int end;
+    // edges between flow indexes sorted by compareEdges
+    Edge* edges;
+    int edgeCount;
+    // tmp arrays for window size + 1 flows
+    Edge* tmpEdges;
+    int* parent;
+    int* partSize;
+}WindowTree;
+
+// structure for storing one node of k-d tree,
+// leaf nodes have left and right children set to -1
+typedef struct SKdNode
+{
+    int begin;
+    int end;
+    int axis;
+    double split;
+    int left;
+    int right;
+}KdNode;
+
+// structure for storing k-d tree over flows in weighted feature space
+typedef struct SKdTree
+{
+    Flow* flows;
+    int flowCount;
+    // flow indexes ordered so every node covers continuous part of them
+    int* order;
+    KdNode* nodes;
+    int nodeCount;
+    Weights weights;
+}KdTree;
+
+// structure for looking up flow's index by its flowID
+typedef struct SFlowKey
+{
+    int flowID;
+    int flowInx;
+}FlowKey;
+
+// structure for storing found neighbour
+typedef struct SNeighbour
+{
+    int flowInx;
+    double range;
+}Neighbour;
+
 // function declaration (used only here for 1 purpose)
 void prepareForDelete(Cluster* cluster, bool rangesCalculated);
 
+// function declaration (verify mode compares weight sweep with reference before it is defined)
+int clusterWithWeightVectors(FILE* out, Flow* flows, int count, Weights* weights, int weightCount,
+    int destClusterCount, Options options);
+
 void freeAll(ClusterStorage* storage, bool rangesCalculated)
 {
     // prepares all clusters in cluster storage for deletion
@@ -164,37 +587,179 @@ int compareClustersFlowCount(const void* a, const void* b)
 
 int compareRanges(const void* a, const void* b)
 {
-    // comparing ranges
-    double arg1 = ((const Range*)a)->range;
-    double arg2 = ((const Range*)b)->range;
+    // comparing ranges, equal ones by indexes of clusters they link (smaller index first),
+    // so they are ordered same way as edges of spanning tree
+    const Range* arg1 = (const Range*)a;
+    const Range* arg2 = (const Range*)b;
 
-    if (arg1 < arg2) return -1;
-    if (arg1 > arg2) return 1;
+    if (arg1->range < arg2->range) return -1;
+    if (arg1->range > arg2->range) return 1;
+    int low1 = arg1->clusterInx < arg1->memberInx ? arg1->clusterInx : arg1->memberInx;
+    int low2 = arg2->clusterInx < arg2->memberInx ? arg2->clusterInx : arg2->memberInx;
+    if (low1 != low2) return low1 < low2 ? -1 : 1;
+    int high1 = arg1->clusterInx < arg1->memberInx ? arg1->memberInx : arg1->clusterInx;
+    int high2 = arg2->clusterInx < arg2->memberInx ? arg2->memberInx : arg2->clusterInx;
+    if (high1 != high2) return high1 < high2 ? -1 : 1;
     return 0;
 }
 
 int compareClustersByRange(const void* a, const void* b)
 {
     // comparing clusters by smallest ranges
-    double arg1 = ((const Cluster*)a)->ranges[0].range;
-    double arg2 = ((const Cluster*)b)->ranges[0].range;
+    return compareRanges(((const Cluster*)a)->ranges, ((const Cluster*)b)->ranges);
+}
+
+int comparePartitions(const void* a, const void* b)
+{
+    // comparing partitions by their keys
+    uint64_t arg1 = ((const Partition*)a)->key;
+    uint64_t arg2 = ((const Partition*)b)->key;
 
     if (arg1 < arg2) return -1;
     if (arg1 > arg2) return 1;
     return 0;
 }
 
+int compareProjectedFlows(const void* a, const void* b)
+{
+    // comparing flows by projection, equal ones by their indexes
+    const ProjectedFlow* arg1 = (const ProjectedFlow*)a;
+    const ProjectedFlow* arg2 = (const ProjectedFlow*)b;
+
+    if (arg1->projection < arg2->projection) return -1;
+    if (arg1->projection > arg2->projection) return 1;
+    if (arg1->flowInx != arg2->flowInx) return arg1->flowInx < arg2->flowInx ? -1 : 1;
+    return 0;
+}
+
+int compareEdges(const void* a, const void* b)
+{
+    // comparing edges by range, equal ones by cluster indexes,
+    // so the order does not depend on qsort implementation
+    const Edge* arg1 = (const Edge*)a;
+    const Edge* arg2 = (const Edge*)b;
+
+    if (arg1->range < arg2->range) return -1;
+    if (arg1->range > arg2->range) return 1;
+    if (arg1->clusterA != arg2->clusterA) return arg1->clusterA < arg2->clusterA ? -1 : 1;
+    if (arg1->clusterB != arg2->clusterB) return arg1->clusterB < arg2->clusterB ? -1 : 1;
+    return 0;
+}
+
+// sorts keys by flowID with LSD radix sort (8 bits per pass), order of equal keys is kept,
+// tmp has to have place for count keys
+void radixSortKeys(FlowKey* keys, FlowKey* tmp, int count)
+{
+    FlowKey* from = keys;
+    FlowKey* to = tmp;
+
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        // sign bit is flipped, so negative flowIDs go first
+        int offsets[257] = {0};
+        for (int i = 0; i < count; i++)
+        {
+            offsets[((((uint32_t)from[i].flowID ^ 0x80000000u) >> shift) & 0xff) + 1]++;
+        }
+
+        // pass is skipped if all keys have same digit
+        if (offsets[((((uint32_t)from[0].flowID ^ 0x80000000u) >> shift) & 0xff) + 1] == count)
+        {
+            continue;
+        }
+
+        for (int d = 1; d < 257; d++)
+        {
+            offsets[d] += offsets[d-1];
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int digit = (((uint32_t)from[i].flowID ^ 0x80000000u) >> shift) & 0xff;
+            to[offsets[digit]] = from[i];
+            offsets[digit]++;
+        }
+
+        FlowKey* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    // odd number of passes leaves result in tmp
+    if (from != keys)
+    {
+        memcpy(keys, from, sizeof(FlowKey)*count);
+    }
+}
+
+// reorders items of any type by their flowIDs stored in keys (flowInx of key is index of item),
+// returns 1 if allocation failed and items were not reordered
+int radixSortItemsByID(void* items, size_t itemSize, FlowKey* keys, int count)
+{
+    FlowKey* tmpKeys = malloc(sizeof(FlowKey)*count);
+    char* tmpItems = malloc(itemSize*count);
+
+    // allocation check
+    if (tmpKeys == NULL || tmpItems == NULL)
+    {
+        free(tmpKeys);
+        free(tmpItems);
+        return 1;
+    }
+
+    radixSortKeys(keys, tmpKeys, count);
+    for (int i = 0; i < count; i++)
+    {
+        memcpy(tmpItems + itemSize*i, (char*)items + itemSize*keys[i].flowInx, itemSize);
+    }
+    memcpy(items, tmpItems, itemSize*count);
+
+    free(tmpKeys);
+    free(tmpItems);
+    return 0;
+}
+
 // sort flow array by smallest flowID
 void sortFlowsByID(Flow* flowArr, int flowCount)
 {
-    // just use qsort function
+    // small arrays are sorted by qsort, it is also used if radix sort can not allocate memory
+    FlowKey* keys = flowCount < 64 ? NULL : malloc(sizeof(FlowKey)*flowCount);
+    if (keys != NULL)
+    {
+        for (int i = 0; i < flowCount; i++)
+        {
+            keys[i].flowID = flowArr[i].flowID;
+            keys[i].flowInx = i;
+        }
+        int result = radixSortItemsByID(flowArr, sizeof(Flow), keys, flowCount);
+        free(keys);
+        if (result == 0)
+        {
+            return;
+        }
+    }
     qsort(flowArr, flowCount, sizeof(Flow), compareFlowsID);
 }
 
-// sort flow array by smallest flowID
+// sort clusters by smallest flowID of their first flows
+// (we assume, that flows in cluster were sorted)
 void sortClustersByID(Cluster* clusters, int clusterCount)
 {
-    // just use qsort function
+    // small arrays are sorted by qsort, it is also used if radix sort can not allocate memory
+    FlowKey* keys = clusterCount < 64 ? NULL : malloc(sizeof(FlowKey)*clusterCount);
+    if (keys != NULL)
+    {
+        for (int i = 0; i < clusterCount; i++)
+        {
+            keys[i].flowID = clusters[i].flows[0].flowID;
+            keys[i].flowInx = i;
+        }
+        int result = radixSortItemsByID(clusters, sizeof(Cluster), keys, clusterCount);
+        free(keys);
+        if (result == 0)
+        {
+            return;
+        }
+    }
     qsort(clusters, clusterCount, sizeof(Cluster), compareClustersID);
 }
 
@@ -211,6 +776,12 @@ void sortRanges(Range* ranges, int rangeCount)
     qsort(ranges, rangeCount, sizeof(Range), compareRanges);
 }
 
+// sort edges from shortest to longest
+void sortEdges(Edge* edges, int edgeCount)
+{
+    qsort(edges, edgeCount, sizeof(Edge), compareEdges);
+}
+
 // sorting ranges in cluster
 void sortRangesInCluster(Cluster* cluster)
 {
@@ -233,510 +804,7048 @@ double squareFloat(double a)
     return a*a;
 }
 
-// calculates square number for int type variable
-int squareInt(int a)
-{
-    return a*a;
-}
-
-// Functions for working with flows and clusters
+// Functions for scheduling work between threads
 // -------------------------------------------------------------------------------------
 
-// calculates average interarrival length
-double calculateAvgInterLength(int totalBytes, int packetCount)
+// pool of threads shared by all parallel parts of program, it is started in main
+Scheduler taskScheduler;
+
+// index of worker running on this thread, -1 for threads outside of pool
+_Thread_local int currentWorker = -1;
+
+// nesting of tasks on this thread, only outermost ones are counted as busy time
+_Thread_local int taskDepth = 0;
+
+// returns monotonic time in seconds
+double currentSeconds(void)
 {
-    // conversion of one of the arguments to double is essential,
-    // since if not we will receive integer,
-    // but there is absolutely no sense to store any of these as double
-    return (double)totalBytes/packetCount;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec*1e-9;
 }
 
-// initialises flow with entered params
-Flow initFlow(int flowID, int totalBytes, int flowDuration, int packetCount, double avgInterarrivalTime)
+// pushes task at bottom of own deque, returns false if deque is full
+bool pushTask(TaskDeque* deque, Task* task)
 {
-    // just creating new flow type variable and placing values in it
-    Flow flow;
-    flow.flowID = flowID;
-    flow.totalBytes = totalBytes;
-    flow.flowDuration = flowDuration;
-    flow.avgInterTime = avgInterarrivalTime;
-    flow.avgInterLength = calculateAvgInterLength(totalBytes, packetCount);
-
-    return flow;
+    long bottom = atomic_load(&deque->bottom);
+    long top = atomic_load(&deque->top);
+    if (bottom - top >= deque->capacity)
+    {
+        return false;
+    }
+    atomic_store(&deque->slots[bottom & (deque->capacity - 1)], task);
+    atomic_store(&deque->bottom, bottom + 1);
+    return true;
 }
 
-// creates cluster with given flows and given number
-Cluster initCluster(Flow flows[], int flowCount)
+// pops task from bottom of own deque, NULL if it is empty
+Task* popTask(TaskDeque* deque)
 {
-    // create cluster type variable
-    Cluster cluster;
-
-    // alloc memory for given flow count
-    cluster.flowCount = flowCount;
-    Flow* tmp = malloc(sizeof(Flow)*flowCount);
+    long bottom = atomic_load(&deque->bottom) - 1;
+    atomic_store(&deque->bottom, bottom);
+    long top = atomic_load(&deque->top);
 
-    // unsuccessful allocation check
-    if (tmp == NULL)
+    if (top > bottom)
     {
-        fprintf(stderr, "ERROR alloc failed\n");
-        cluster.flowCount = -1;
+        atomic_store(&deque->bottom, bottom + 1);
+        return NULL;
     }
-    else
-    {
-        // if successful store pointer and place all data from
-        // given flow array to flow array inside the cluster
-        cluster.flows = tmp;
 
-        // sorts flows by their ID
-        sortFlowsByID(flows, flowCount);
-        for (int i = 0; i < flowCount; i++)
+    Task* task = atomic_load(&deque->slots[bottom & (deque->capacity - 1)]);
+    if (top == bottom)
+    {
+        // last task can be stolen at the same time, only one thread gets it
+        if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
         {
-            cluster.flows[i] = flows[i];
+            task = NULL;
         }
+        atomic_store(&deque->bottom, bottom + 1);
     }
-    return cluster;
+    return task;
 }
 
-// creates cluster storage from given clusters and their count
-ClusterStorage initClusterStorage(Cluster clusters[], int clusterCount)
+// steals task from top of other worker's deque, NULL if it is empty or other thread was faster
+Task* stealTask(TaskDeque* deque)
 {
-    // create empty cluster storage
-    ClusterStorage storage;
+    long top = atomic_load(&deque->top);
+    long bottom = atomic_load(&deque->bottom);
+    if (top >= bottom)
+    {
+        return NULL;
+    }
 
-    // allocate memory for given cluster count
-    storage.clusterCount = clusterCount;
-    Cluster* tmp = malloc(sizeof(Cluster)*clusterCount);
+    Task* task = atomic_load(&deque->slots[top & (deque->capacity - 1)]);
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
+    {
+        return NULL;
+    }
+    return task;
+}
 
-    // unsuccessful allocation check
-    if (tmp == NULL)
+// finds task for worker, own tasks first, then tasks of other workers
+Task* findTask(int worker)
+{
+    Task* task = popTask(&taskScheduler.deques[worker]);
+    if (task != NULL)
     {
-        fprintf(stderr, "ERROR alloc failed\n");
-        storage.clusterCount = -1;
+        return task;
     }
-    else
+
+    for (int i = 1; i < taskScheduler.threadCount; i++)
     {
-        // if successful store pointer and store all clusters given in array
-        storage.clusters = tmp;
-        for (int i = 0; i < clusterCount; i++)
+        int victim = (worker + i) % taskScheduler.threadCount;
+        taskScheduler.stats[worker].stealAttempts++;
+        task = stealTask(&taskScheduler.deques[victim]);
+        if (task != NULL)
         {
-            storage.clusters[i] = clusters[i];
+            taskScheduler.stats[worker].stealCount++;
+            return task;
         }
     }
-    return storage;
+    return NULL;
 }
 
-// creates range with user-entered parameters
-Range initRange(int flowID, double rangeTo)
+// wakes sleeping workers after task was pushed
+void announceTask(void)
 {
-    Range r;
-    r.flowID = flowID;
-    r.range = rangeTo;
-    return r;
+    atomic_fetch_add(&taskScheduler.generation, 1);
+    if (atomic_load(&taskScheduler.sleepingCount) > 0)
+    {
+        pthread_mutex_lock(&taskScheduler.sleepLock);
+        pthread_cond_broadcast(&taskScheduler.wakeUp);
+        pthread_mutex_unlock(&taskScheduler.sleepLock);
+    }
 }
 
-// unites 2 sets of ranges from 2 clusters and records them to new united cluster
-int uniteRangesInClusters(Cluster* clusterA, Cluster* clusterB, Cluster* unitedCluster)
+// runs task, halves of it bigger than grain are pushed first so idle workers can steal them
+void runTask(Task* task)
 {
-    // init tmp variable used inside the function
-    int writtenCount = 0;
-
-    // allocating tmp range array for united cluster list
-    Range* tmp1 = malloc(sizeof(Range)*(clusterA->rangeCount + clusterB->rangeCount));
+    int worker = currentWorker;
 
-    // unsuccessful allocation check
-    if (tmp1 == NULL)
+    while (task->end - task->begin > task->grain)
     {
-        return 1;
-    }
+        Task* half = malloc(sizeof(Task));
+        if (half == NULL)
+        {
+            break;
+        }
+        int middle = task->begin + (task->end - task->begin)/2;
+        *half = *task;
+        half->begin = middle;
 
-    // recording only shortest ranges
-    for (int i = 1; i < clusterA->rangeCount; i++)
-    {
-        for (int j = 1; j < clusterB->rangeCount; j++)
+        // pushed half can be stolen and freed right away, so it is not touched after push
+        atomic_fetch_add(&task->group->pending, 1);
+        if (!pushTask(&taskScheduler.deques[worker], half))
         {
-            if (clusterA->ranges[i].flowID == clusterB->ranges[j].flowID)
-            {
-                if (clusterA->ranges[i].range > clusterB->ranges[j].range)
-                {
-                    tmp1[writtenCount] = initRange(clusterA->ranges[i].flowID, clusterB->ranges[j].range);
-                }
-                else
-                {
-                    tmp1[writtenCount] = initRange(clusterA->ranges[i].flowID, clusterA->ranges[i].range);
-                }
-                writtenCount++;
-                break;
-            }
+            // full deque means there is enough work for others, rest is done here
+            atomic_fetch_sub(&task->group->pending, 1);
+            free(half);
+            break;
         }
+        task->end = middle;
+        announceTask();
     }
 
-    if (writtenCount == 0)
-    {
-        unitedCluster->rangeCount = 1;
-    }
-    else
+    double start = taskDepth == 0 ? currentSeconds() : 0;
+    taskDepth++;
+    task->body(task->context, task->begin, task->end);
+    taskDepth--;
+    if (taskDepth == 0)
     {
-        unitedCluster->rangeCount = writtenCount;
+        taskScheduler.stats[worker].busySeconds += currentSeconds() - start;
     }
+    taskScheduler.stats[worker].taskCount++;
 
-    // allocating tmp range array for united cluster list
-    Range* tmp = realloc(tmp1, sizeof(Range)*(unitedCluster->rangeCount));
+    atomic_fetch_sub(&task->group->pending, 1);
+}
 
+// main loop of worker threads, they run tasks and sleep when there are none
+void* workerLoop(void* arg)
+{
+    currentWorker = (int)(intptr_t)arg;
+    int idleRounds = 0;
 
+    while (!atomic_load(&taskScheduler.isStopping))
+    {
+        long generation = atomic_load(&taskScheduler.generation);
+        Task* task = findTask(currentWorker);
+        if (task != NULL)
+        {
+            runTask(task);
+            free(task);
+            idleRounds = 0;
+            continue;
+        }
+
+        // spins for a while, since next parallel loop usually starts soon
+        idleRounds++;
+        if (idleRounds < 64)
+        {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&taskScheduler.sleepLock);
+        atomic_fetch_add(&taskScheduler.sleepingCount, 1);
+        if (generation == atomic_load(&taskScheduler.generation) && !atomic_load(&taskScheduler.isStopping))
+        {
+            pthread_cond_wait(&taskScheduler.wakeUp, &taskScheduler.sleepLock);
+        }
+        atomic_fetch_sub(&taskScheduler.sleepingCount, 1);
+        pthread_mutex_unlock(&taskScheduler.sleepLock);
+        idleRounds = 0;
+    }
+    return NULL;
+}
+
+// frees all arrays of pool
+void freeScheduler(int dequeCount)
+{
+    for (int i = 0; i < dequeCount; i++)
+    {
+        free((void*)taskScheduler.deques[i].slots);
+    }
+    free(taskScheduler.threads);
+    free(taskScheduler.deques);
+    free(taskScheduler.stats);
+}
+
+// starts pool with given number of threads (0 means all processors available to process),
+// threads are pinned to processors if there are not more threads than processors
+int startScheduler(int threadCount)
+{
+    cpu_set_t allowed;
+    int allowedCpus[CPU_SETSIZE];
+    int allowedCount = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                allowedCpus[allowedCount] = cpu;
+                allowedCount++;
+            }
+        }
+    }
+    if (threadCount == 0)
+    {
+        threadCount = allowedCount > 0 ? allowedCount : 1;
+    }
+
+    taskScheduler.threadCount = threadCount;
+    taskScheduler.isPinned = allowedCount > 0 && threadCount <= allowedCount;
+    taskScheduler.startTime = currentSeconds();
+    atomic_init(&taskScheduler.isStopping, false);
+    atomic_init(&taskScheduler.generation, 0);
+    atomic_init(&taskScheduler.sleepingCount, 0);
+    taskScheduler.threads = malloc(sizeof(pthread_t)*threadCount);
+    taskScheduler.deques = calloc(threadCount, sizeof(TaskDeque));
+    taskScheduler.stats = calloc(threadCount, sizeof(WorkerStats));
+
+    // allocation check
+    if (taskScheduler.threads == NULL || taskScheduler.deques == NULL || taskScheduler.stats == NULL)
+    {
+        freeScheduler(0);
+        return 1;
+    }
+    for (int i = 0; i < threadCount; i++)
+    {
+        TaskDeque* deque = &taskScheduler.deques[i];
+        deque->capacity = 4096;
+        deque->slots = malloc(sizeof(_Atomic(Task*))*deque->capacity);
+        if (deque->slots == NULL)
+        {
+            freeScheduler(i);
+            return 1;
+        }
+        atomic_init(&deque->top, 0);
+        atomic_init(&deque->bottom, 0);
+    }
+    pthread_mutex_init(&taskScheduler.sleepLock, NULL);
+    pthread_cond_init(&taskScheduler.wakeUp, NULL);
+
+    // calling thread is worker 0
+    currentWorker = 0;
+    for (int i = 0; i < threadCount; i++)
+    {
+        if (i > 0 && pthread_create(&taskScheduler.threads[i], NULL, workerLoop, (void*)(intptr_t)i) != 0)
+        {
+            // workers which were not started are never used
+            for (int n = i; n < threadCount; n++)
+            {
+                free((void*)taskScheduler.deques[n].slots);
+            }
+            taskScheduler.threadCount = i;
+            break;
+        }
+        if (taskScheduler.isPinned)
+        {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(allowedCpus[i], &cpus);
+            pthread_t thread = i == 0 ? pthread_self() : taskScheduler.threads[i];
+            taskScheduler.isPinned = pthread_setaffinity_np(thread, sizeof(cpus), &cpus) == 0;
+        }
+    }
+    return 0;
+}
+
+// stops all workers and prints their statistics if it was asked
+void stopScheduler(bool printStats)
+{
+    pthread_mutex_lock(&taskScheduler.sleepLock);
+    atomic_store(&taskScheduler.isStopping, true);
+    pthread_cond_broadcast(&taskScheduler.wakeUp);
+    pthread_mutex_unlock(&taskScheduler.sleepLock);
+
+    for (int i = 1; i < taskScheduler.threadCount; i++)
+    {
+        pthread_join(taskScheduler.threads[i], NULL);
+    }
+
+    if (printStats)
+    {
+        double wallSeconds = currentSeconds() - taskScheduler.startTime;
+        fprintf(stderr, "Stats:\n");
+        fprintf(stderr, "threads: %i%s, time: %.6f s\n", taskScheduler.threadCount,
+            taskScheduler.isPinned ? " (pinned)" : "", wallSeconds);
+        for (int i = 0; i < taskScheduler.threadCount; i++)
+        {
+            WorkerStats stats = taskScheduler.stats[i];
+            fprintf(stderr, "worker %i: tasks %li, steals %li/%li, busy %.6f s (%.1f %%)\n", i,
+                stats.taskCount, stats.stealCount, stats.stealAttempts, stats.busySeconds,
+                wallSeconds > 0 ? 100*stats.busySeconds/wallSeconds : 0);
+        }
+
+        long fullCount = 0;
+        long abandonedCount = 0;
+        long skippedCount = 0;
+        for (int i = 0; i < taskScheduler.threadCount; i++)
+        {
+            fullCount += taskScheduler.stats[i].fullRangeCount;
+            abandonedCount += taskScheduler.stats[i].abandonedRangeCount;
+            skippedCount += taskScheduler.stats[i].skippedRangeCount;
+        }
+        fprintf(stderr, "nearest neighbour search: full ranges %li, abandoned %li, skipped by projection %li\n",
+            fullCount, abandonedCount, skippedCount);
+    }
+
+    freeScheduler(taskScheduler.threadCount);
+    pthread_mutex_destroy(&taskScheduler.sleepLock);
+    pthread_cond_destroy(&taskScheduler.wakeUp);
+    taskScheduler.threadCount = 0;
+    currentWorker = -1;
+}
+
+// calls body for parts of range from 0 to count, parts are run by workers of pool while
+// calling worker helps with any tasks until all parts are done (fork-join),
+// threads outside of pool run whole range themselves
+void parallelFor(int count, int grain, void (*body)(void* context, int begin, int end), void* context)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+    if (currentWorker < 0)
+    {
+        body(context, 0, count);
+        return;
+    }
+
+    TaskGroup group;
+    atomic_init(&group.pending, 1);
+    Task root;
+    root.body = body;
+    root.context = context;
+    root.begin = 0;
+    root.end = count;
+    root.grain = grain < 1 ? 1 : grain;
+    root.group = &group;
+    if (taskScheduler.threadCount <= 1)
+    {
+        // there is nobody to steal parts, so loop is not split
+        root.grain = count;
+    }
+    runTask(&root);
+
+    while (atomic_load(&group.pending) > 0)
+    {
+        Task* task = findTask(currentWorker);
+        if (task != NULL)
+        {
+            runTask(task);
+            free(task);
+        }
+        else
+        {
+            sched_yield();
+        }
+    }
+}
+
+// Functions for tracing
+// -------------------------------------------------------------------------------------
+
+// probes are compiled only with -DFLOWS_TRACE, otherwise they are empty and cost nothing;
+// every probe is a span from start time to now (or instant if start is negative)
+// carrying sizes of 2 clusters or blocks, merge distance and count of clusters
+#ifdef FLOWS_TRACE
+
+// events are kept in ring, the oldest ones are overwritten when it is full
+#define TRACE_CAPACITY (1 << 16)
+
+// structure for storing one trace event
+typedef struct STraceEvent
+{
+    const char* name;
+    // microseconds from start of tracing, duration is negative for instant events
+    double start;
+    double duration;
+    int thread;
+    int sizeA;
+    int sizeB;
+    double distance;
+    int count;
+}TraceEvent;
+
+TraceEvent traceEvents[TRACE_CAPACITY];
+_Atomic long traceEventCount;
+double traceStartTime;
+
+#define TRACE_START(start) double start = currentSeconds()
+#define TRACE_KEEP(type, name, value) type name = value
+#define TRACE_SPAN(name, start, sizeA, sizeB, distance, count) \
+    traceEvent(name, start, sizeA, sizeB, distance, count)
+#define TRACE_MARK(name, sizeA, sizeB, distance, count) \
+    traceEvent(name, -1, sizeA, sizeB, distance, count)
+
+// records event to ring, it can be called from any thread
+void traceEvent(const char* name, double start, int sizeA, int sizeB, double distance, int count)
+{
+    double now = currentSeconds();
+    long index = atomic_fetch_add(&traceEventCount, 1);
+    TraceEvent* event = &traceEvents[index % TRACE_CAPACITY];
+    event->name = name;
+    event->start = ((start >= 0 ? start : now) - traceStartTime)*1e6;
+    event->duration = start >= 0 ? (now - start)*1e6 : -1;
+    event->thread = currentWorker;
+    event->sizeA = sizeA;
+    event->sizeB = sizeB;
+    event->distance = distance;
+    event->count = count;
+}
+
+#else
+
+#define TRACE_START(start)
+#define TRACE_KEEP(type, name, value)
+#define TRACE_SPAN(name, start, sizeA, sizeB, distance, count)
+#define TRACE_MARK(name, sizeA, sizeB, distance, count)
+
+#endif
+
+// starts tracing, times of events are counted from now
+void startTrace(void)
+{
+#ifdef FLOWS_TRACE
+    atomic_init(&traceEventCount, 0);
+    traceStartTime = currentSeconds();
+#endif
+}
+
+// writes events in ring to file as Chrome trace JSON (chrome://tracing, Perfetto),
+// arguments which were not given (-1 or NaN) are left out, returns 1 if file failed
+int writeTrace(const char* path)
+{
+#ifdef FLOWS_TRACE
+    FILE* out = fopen(path, "w");
+    if (out == NULL)
+    {
+        return 1;
+    }
+
+    long eventCount = atomic_load(&traceEventCount);
+    long first = eventCount > TRACE_CAPACITY ? eventCount - TRACE_CAPACITY : 0;
+    fprintf(out, "{\"traceEvents\":[");
+    for (long i = first; i < eventCount; i++)
+    {
+        const TraceEvent* event = &traceEvents[i % TRACE_CAPACITY];
+        fprintf(out, "%s\n{\"name\":\"%s\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,", i > first ? "," : "",
+            event->name, event->thread, event->start);
+        if (event->duration >= 0)
+        {
+            fprintf(out, "\"ph\":\"X\",\"dur\":%.3f,", event->duration);
+        }
+        else
+        {
+            fprintf(out, "\"ph\":\"i\",\"s\":\"t\",");
+        }
+
+        fprintf(out, "\"args\":{");
+        const char* separator = "";
+        if (event->sizeA >= 0)
+        {
+            fprintf(out, "\"sizeA\":%i", event->sizeA);
+            separator = ",";
+        }
+        if (event->sizeB >= 0)
+        {
+            fprintf(out, "%s\"sizeB\":%i", separator, event->sizeB);
+            separator = ",";
+        }
+        if (isfinite(event->distance))
+        {
+            fprintf(out, "%s\"distance\":%.17g", separator, event->distance);
+            separator = ",";
+        }
+        if (event->count >= 0)
+        {
+            fprintf(out, "%s\"count\":%i", separator, event->count);
+        }
+        fprintf(out, "}}");
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"events\":%li,\"dropped\":%li}}\n",
+        eventCount, first);
+    return fclose(out) != 0;
+#else
+    (void)path;
+    return 1;
+#endif
+}
+
+// Functions for placing large buffers in memory
+// -------------------------------------------------------------------------------------
+
+// policy and statistics of large buffers, they are set in main
+Placement memoryPlacement;
+
+// returns size rounded up to multiple of alignment (power of 2)
+size_t roundUpSize(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// reads online NUMA nodes to mask, returns count of them (0 if they are not known)
+int readOnlineNodes(unsigned long* mask)
+{
+    memset(mask, 0, sizeof(unsigned long)*PLACEMENT_MAX_NODES/64);
+    FILE* file = fopen("/sys/devices/system/node/online", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    char line[256];
+    bool isRead = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+    if (!isRead)
+    {
+        return 0;
+    }
+
+    // list of node ranges like "0-1,3"
+    int nodeCount = 0;
+    char* position = line;
+    while (isdigit((unsigned char)*position))
+    {
+        long first = strtol(position, &position, 10);
+        long last = first;
+        if (*position == '-')
+        {
+            last = strtol(position + 1, &position, 10);
+        }
+        for (long node = first; node <= last && node < PLACEMENT_MAX_NODES; node++)
+        {
+            mask[node/64] |= 1UL << (node % 64);
+            nodeCount++;
+        }
+        if (*position == ',')
+        {
+            position++;
+        }
+    }
+    return nodeCount;
+}
+
+// spreads pages of mapping over all online nodes round-robin, returns 1 if it failed
+int interleaveMapping(void* data, size_t size)
+{
+#ifdef SYS_mbind
+    unsigned long mask[PLACEMENT_MAX_NODES/64];
+    if (readOnlineNodes(mask) == 0)
+    {
+        return 1;
+    }
+    // kernel takes count of bits in mask plus one
+    return syscall(SYS_mbind, data, size, PLACEMENT_MPOL_INTERLEAVE, mask,
+        (unsigned long)PLACEMENT_MAX_NODES + 1, 0UL) != 0;
+#else
+    (void)data;
+    (void)size;
+    return 1;
+#endif
+}
+
+// maps memory for buffer with its page kind, huge pages need mapping aligned to them,
+// so larger mapping is made and its ends are unmapped, returns NULL if it failed
+void* mapLargeBuffer(LargeBuffer* buffer)
+{
+    // buffers smaller than huge page would waste most of it
+    int pageKind = buffer->size >= PLACEMENT_HUGE_PAGE ? memoryPlacement.pageKind : smallPages;
+    if (pageKind == explicitPages)
+    {
+        buffer->mappedSize = roundUpSize(buffer->size, PLACEMENT_HUGE_PAGE);
+        void* data = mmap(NULL, buffer->mappedSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data != MAP_FAILED)
+        {
+            buffer->isHugeTlb = true;
+            return data;
+        }
+
+        // there are no reserved huge pages, so transparent ones are used
+        pthread_mutex_lock(&memoryPlacement.lock);
+        memoryPlacement.hugeTlbFallbacks++;
+        pthread_mutex_unlock(&memoryPlacement.lock);
+    }
+
+    size_t alignment = pageKind == smallPages ? (size_t)sysconf(_SC_PAGESIZE) : PLACEMENT_HUGE_PAGE;
+    buffer->mappedSize = roundUpSize(buffer->size, alignment);
+    size_t extraSize = alignment > (size_t)sysconf(_SC_PAGESIZE) ? alignment : 0;
+    char* mapping = mmap(NULL, buffer->mappedSize + extraSize, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    char* data = (char*)roundUpSize((uintptr_t)mapping, alignment);
+    if (data > mapping)
+    {
+        munmap(mapping, (size_t)(data - mapping));
+    }
+    char* mappingEnd = mapping + buffer->mappedSize + extraSize;
+    if (mappingEnd > data + buffer->mappedSize)
+    {
+        munmap(data + buffer->mappedSize, (size_t)(mappingEnd - (data + buffer->mappedSize)));
+    }
+    if (pageKind != smallPages)
+    {
+        madvise(data, buffer->mappedSize, MADV_HUGEPAGE);
+    }
+    return data;
+}
+
+// structure for sharing first touch of buffer's pages between tasks
+typedef struct SPageTouch
+{
+    char* data;
+    size_t size;
+    size_t pageSize;
+}PageTouch;
+
+// writes to every page of part of 2 MB blocks, so they are placed on node of worker
+void touchLargePages(void* context, int begin, int end)
+{
+    PageTouch* touch = context;
+    size_t blockEnd = (size_t)end*PLACEMENT_HUGE_PAGE < touch->size ? (size_t)end*PLACEMENT_HUGE_PAGE : touch->size;
+    for (size_t offset = (size_t)begin*PLACEMENT_HUGE_PAGE; offset < blockEnd; offset += touch->pageSize)
+    {
+        touch->data[offset] = 0;
+    }
+}
+
+// allocates buffer for big arrays with placement policy from options, buffer has to be
+// released by freeLarge, returns NULL if allocation failed
+void* allocateLarge(size_t size, const char* name)
+{
+    LargeBuffer buffer;
+    buffer.size = size > 0 ? size : 1;
+    buffer.mappedSize = 0;
+    buffer.isHugeTlb = false;
+    buffer.name = name;
+
+    // default placement keeps normal allocation
+    if (memoryPlacement.policy == defaultPlacement && memoryPlacement.pageKind == smallPages)
+    {
+        buffer.data = malloc(buffer.size);
+    }
+    else
+    {
+        buffer.data = mapLargeBuffer(&buffer);
+        if (buffer.data != NULL && memoryPlacement.policy == interleavePlacement &&
+            interleaveMapping(buffer.data, buffer.mappedSize) != 0)
+        {
+            pthread_mutex_lock(&memoryPlacement.lock);
+            memoryPlacement.policyFailures++;
+            pthread_mutex_unlock(&memoryPlacement.lock);
+        }
+    }
+    if (buffer.data == NULL)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&memoryPlacement.lock);
+    if (memoryPlacement.bufferCount == memoryPlacement.capacity)
+    {
+        int capacity = memoryPlacement.capacity > 0 ? memoryPlacement.capacity*2 : 16;
+        LargeBuffer* tmp = realloc(memoryPlacement.buffers, sizeof(LargeBuffer)*capacity);
+        if (tmp == NULL)
+        {
+            pthread_mutex_unlock(&memoryPlacement.lock);
+            if (buffer.mappedSize > 0)
+            {
+                munmap(buffer.data, buffer.mappedSize);
+            }
+            else
+            {
+                free(buffer.data);
+            }
+            return NULL;
+        }
+        memoryPlacement.buffers = tmp;
+        memoryPlacement.capacity = capacity;
+    }
+    memoryPlacement.buffers[memoryPlacement.bufferCount] = buffer;
+    memoryPlacement.bufferCount++;
+    memoryPlacement.allocationCount++;
+    memoryPlacement.allocatedBytes += buffer.size;
+    pthread_mutex_unlock(&memoryPlacement.lock);
+
+    // pages are touched in parallel the same way as loops over arrays are split between tasks
+    if (memoryPlacement.policy == firstTouchPlacement && buffer.mappedSize > 0)
+    {
+        PageTouch touch;
+        touch.data = buffer.data;
+        touch.size = buffer.mappedSize;
+        touch.pageSize = buffer.isHugeTlb ? PLACEMENT_HUGE_PAGE : (size_t)sysconf(_SC_PAGESIZE);
+        parallelFor((int)((buffer.mappedSize + PLACEMENT_HUGE_PAGE - 1)/PLACEMENT_HUGE_PAGE), 1,
+            touchLargePages, &touch);
+    }
+    return buffer.data;
+}
+
+// returns bytes of mapping which are backed by transparent huge pages (from /proc/self/smaps)
+size_t countHugeBytes(const LargeBuffer* buffer)
+{
+    FILE* file = fopen("/proc/self/smaps", "r");
+    if (file == NULL)
+    {
+        return 0;
+    }
+
+    uintptr_t begin = (uintptr_t)buffer->data;
+    uintptr_t end = begin + buffer->mappedSize;
+    bool isInside = false;
+    size_t hugeBytes = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        unsigned long mappingBegin;
+        unsigned long mappingEnd;
+        unsigned long kiloBytes;
+        if (sscanf(line, "%lx-%lx ", &mappingBegin, &mappingEnd) == 2)
+        {
+            isInside = mappingBegin < end && mappingEnd > begin;
+        }
+        else if (isInside && sscanf(line, "AnonHugePages: %lu kB", &kiloBytes) == 1)
+        {
+            hugeBytes += (size_t)kiloBytes*1024;
+        }
+    }
+    fclose(file);
+    return hugeBytes;
+}
+
+// adds placement of buffer's pages to statistics, nodes are found for sample of pages
+void recordPlacement(const LargeBuffer* buffer)
+{
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = (uintptr_t)buffer->data & ~(uintptr_t)(pageSize - 1);
+    size_t pageCount = ((uintptr_t)buffer->data + buffer->size - first + pageSize - 1)/pageSize;
+    int sampleCount = pageCount < PLACEMENT_SAMPLES ? (int)pageCount : PLACEMENT_SAMPLES;
+
+    void* pages[PLACEMENT_SAMPLES];
+    int status[PLACEMENT_SAMPLES];
+    for (int i = 0; i < sampleCount; i++)
+    {
+        pages[i] = (void*)(first + (pageCount*i/sampleCount)*pageSize);
+    }
+    bool isKnown = false;
+#ifdef SYS_move_pages
+    // without target nodes kernel only writes node of every page to status
+    isKnown = syscall(SYS_move_pages, 0, (unsigned long)sampleCount, pages, NULL, status, 0) == 0;
+#endif
+
+    size_t hugeBytes = 0;
+    if (buffer->isHugeTlb)
+    {
+        hugeBytes = buffer->mappedSize;
+    }
+    else if (buffer->mappedSize > 0)
+    {
+        hugeBytes = countHugeBytes(buffer);
+    }
+    hugeBytes = hugeBytes < buffer->size ? hugeBytes : buffer->size;
+
+    pthread_mutex_lock(&memoryPlacement.lock);
+    memoryPlacement.hugeBytes += hugeBytes;
+    for (int i = 0; i < sampleCount && isKnown; i++)
+    {
+        if (status[i] >= 0 && status[i] < PLACEMENT_MAX_NODES)
+        {
+            memoryPlacement.nodePages[status[i]]++;
+        }
+        else
+        {
+            memoryPlacement.missingPages++;
+        }
+    }
+    memoryPlacement.unknownBuffers += !isKnown;
+    pthread_mutex_unlock(&memoryPlacement.lock);
+}
+
+// releases buffer allocated by allocateLarge, its placement is recorded if statistics are printed
+void freeLarge(void* data)
+{
+    if (data == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&memoryPlacement.lock);
+    LargeBuffer buffer;
+    buffer.data = NULL;
+    for (int i = 0; i < memoryPlacement.bufferCount; i++)
+    {
+        if (memoryPlacement.buffers[i].data == data)
+        {
+            buffer = memoryPlacement.buffers[i];
+            memoryPlacement.bufferCount--;
+            memoryPlacement.buffers[i] = memoryPlacement.buffers[memoryPlacement.bufferCount];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&memoryPlacement.lock);
+
+    if (buffer.data == NULL)
+    {
+        fprintf(stderr, "ERROR: Released buffer was not allocated as large one\n");
+        return;
+    }
+    if (memoryPlacement.isCollecting)
+    {
+        recordPlacement(&buffer);
+    }
+    if (buffer.mappedSize > 0)
+    {
+        munmap(buffer.data, buffer.mappedSize);
+    }
+    else
+    {
+        free(buffer.data);
+    }
+}
+
+// checks if pointer points inside of some large buffer (rows of range matrix are not freed alone)
+bool isInsideLargeBuffer(const void* pointer)
+{
+    bool isInside = false;
+    pthread_mutex_lock(&memoryPlacement.lock);
+    for (int i = 0; i < memoryPlacement.bufferCount && !isInside; i++)
+    {
+        uintptr_t begin = (uintptr_t)memoryPlacement.buffers[i].data;
+        isInside = (uintptr_t)pointer >= begin && (uintptr_t)pointer < begin + memoryPlacement.buffers[i].size;
+    }
+    pthread_mutex_unlock(&memoryPlacement.lock);
+    return isInside;
+}
+
+// sets policy of large buffers, statistics are collected only if they are printed
+void startPlacement(int policy, int pageKind, bool isCollecting)
+{
+    memset(&memoryPlacement, 0, sizeof(memoryPlacement));
+    memoryPlacement.policy = policy;
+    memoryPlacement.pageKind = pageKind;
+    memoryPlacement.isCollecting = isCollecting;
+    pthread_mutex_init(&memoryPlacement.lock, NULL);
+}
+
+// prints placement of all large buffers if it was collected
+void stopPlacement(void)
+{
+    if (memoryPlacement.isCollecting)
+    {
+        const char* policies[] = {"default", "interleave", "first-touch"};
+        const char* pageKinds[] = {"small pages", "transparent huge pages", "explicit huge pages"};
+        fprintf(stderr, "placement: %s, %s\n", policies[memoryPlacement.policy],
+            pageKinds[memoryPlacement.pageKind]);
+        fprintf(stderr, "large buffers: %li, %.1f MB, on huge pages %.1f MB, hugetlb fallbacks %li, "
+            "policy failures %li\n", memoryPlacement.allocationCount, memoryPlacement.allocatedBytes/1048576.0,
+            memoryPlacement.hugeBytes/1048576.0, memoryPlacement.hugeTlbFallbacks, memoryPlacement.policyFailures);
+
+        long sampledCount = memoryPlacement.missingPages;
+        for (int node = 0; node < PLACEMENT_MAX_NODES; node++)
+        {
+            sampledCount += memoryPlacement.nodePages[node];
+        }
+        fprintf(stderr, "sampled pages: %li", sampledCount);
+        for (int node = 0; node < PLACEMENT_MAX_NODES; node++)
+        {
+            if (memoryPlacement.nodePages[node] > 0)
+            {
+                fprintf(stderr, ", node %i %.1f %%", node, 100.0*memoryPlacement.nodePages[node]/sampledCount);
+            }
+        }
+        if (memoryPlacement.missingPages > 0)
+        {
+            fprintf(stderr, ", not present %.1f %%", 100.0*memoryPlacement.missingPages/sampledCount);
+        }
+        if (memoryPlacement.unknownBuffers > 0)
+        {
+            fprintf(stderr, " (nodes of %li buffers are not known)", memoryPlacement.unknownBuffers);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    free(memoryPlacement.buffers);
+    memoryPlacement.buffers = NULL;
+    pthread_mutex_destroy(&memoryPlacement.lock);
+}
+
+// Functions for working with flows and clusters
+// -------------------------------------------------------------------------------------
+
+// returns feature of flow by its axis number
+double getFeature(Flow flow, int axis)
+{
+    switch (axis)
+    {
+        case 0:
+            return flow.totalBytes;
+        case 1:
+            return flow.flowDuration;
+        case 2:
+            return flow.avgInterTime;
+        default:
+            return flow.avgInterLength;
+    }
+}
+
+// returns weight of feature by its axis number
+double getWeight(Weights weights, int axis)
+{
+    switch (axis)
+    {
+        case 0:
+            return weights.bytes;
+        case 1:
+            return weights.duration;
+        case 2:
+            return weights.interTime;
+        default:
+            return weights.interLength;
+    }
+}
+
+// merges of clusters done by engines, they are recorded only if result is exported with them
+MergeLog mergeLog;
+
+// records merge of clusters linked by 2 flows, does nothing if merges are not recorded
+void recordMerge(int flowA, int flowB, double range)
+{
+    if (mergeLog.merges == NULL || mergeLog.mergeCount >= mergeLog.capacity)
+    {
+        return;
+    }
+    FlowsExportMerge* merge = &mergeLog.merges[mergeLog.mergeCount];
+    merge->flowA = flowA;
+    merge->flowB = flowB;
+    merge->range = range;
+    mergeLog.mergeCount++;
+}
+
+// calculates average interarrival length
+double calculateAvgInterLength(int totalBytes, int packetCount)
+{
+    // conversion of one of the arguments to double is essential,
+    // since if not we will receive integer,
+    // but there is absolutely no sense to store any of these as double
+    return (double)totalBytes/packetCount;
+}
+
+// initialises flow with entered params
+Flow initFlow(int flowID, int inputInx, int totalBytes, int flowDuration, int packetCount,
+    double avgInterarrivalTime)
+{
+    // just creating new flow type variable and placing values in it
+    Flow flow;
+    flow.flowID = flowID;
+    flow.inputInx = inputInx;
+    flow.totalBytes = totalBytes;
+    flow.flowDuration = flowDuration;
+    flow.avgInterTime = avgInterarrivalTime;
+    flow.avgInterLength = calculateAvgInterLength(totalBytes, packetCount);
+
+    return flow;
+}
+
+// stats of clusters are collected only if they are printed
+bool isCollectingStats = false;
+
+// returns stats of cluster without flows, uniting with it changes nothing
+ClusterStats initEmptyStats(void)
+{
+    ClusterStats stats;
+    for (int k = 0; k < 4; k++)
+    {
+        stats.sums[k] = 0;
+        stats.mins[k] = INFINITY;
+        stats.maxs[k] = -INFINITY;
+    }
+    stats.mergeHeight = 0;
+    return stats;
+}
+
+// returns stats of 2 clusters united together
+ClusterStats uniteStats(ClusterStats statsA, ClusterStats statsB)
+{
+    ClusterStats stats;
+    for (int k = 0; k < 4; k++)
+    {
+        stats.sums[k] = statsA.sums[k] + statsB.sums[k];
+        stats.mins[k] = statsA.mins[k] < statsB.mins[k] ? statsA.mins[k] : statsB.mins[k];
+        stats.maxs[k] = statsA.maxs[k] > statsB.maxs[k] ? statsA.maxs[k] : statsB.maxs[k];
+    }
+    stats.mergeHeight = statsA.mergeHeight > statsB.mergeHeight ? statsA.mergeHeight : statsB.mergeHeight;
+    return stats;
+}
+
+// returns stats of cluster with given flows
+ClusterStats initStats(Flow flows[], int flowCount)
+{
+    ClusterStats stats = initEmptyStats();
+    for (int i = 0; i < flowCount; i++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            double feature = getFeature(flows[i], k);
+            stats.sums[k] += feature;
+            stats.mins[k] = feature < stats.mins[k] ? feature : stats.mins[k];
+            stats.maxs[k] = feature > stats.maxs[k] ? feature : stats.maxs[k];
+        }
+    }
+    return stats;
+}
+
+// creates cluster with given flows and given number
+Cluster initCluster(Flow flows[], int flowCount)
+{
+    // create cluster type variable
+    Cluster cluster;
+
+    // ranges are calculated only later
+    cluster.rangeCount = 0;
+    cluster.ranges = NULL;
+
+    // alloc memory for given flow count
+    cluster.flowCount = flowCount;
+    Flow* tmp = malloc(sizeof(Flow)*flowCount);
+    cluster.stats = isCollectingStats ? malloc(sizeof(ClusterStats)) : NULL;
+
+    // unsuccessful allocation check
+    if (tmp == NULL || (isCollectingStats && cluster.stats == NULL))
+    {
+        fprintf(stderr, "ERROR alloc failed\n");
+        free(tmp);
+        free(cluster.stats);
+        cluster.stats = NULL;
+        cluster.flowCount = -1;
+    }
+    else
+    {
+        // if successful store pointer and place all data from
+        // given flow array to flow array inside the cluster
+        cluster.flows = tmp;
+
+        // sorts flows by their ID
+        sortFlowsByID(flows, flowCount);
+        for (int i = 0; i < flowCount; i++)
+        {
+            cluster.flows[i] = flows[i];
+        }
+        if (cluster.stats != NULL)
+        {
+            *cluster.stats = initStats(flows, flowCount);
+        }
+    }
+    return cluster;
+}
+
+// creates range with user-entered parameters
+Range initRange(int clusterInx, int memberInx, double rangeTo)
+{
+    Range r;
+    r.clusterInx = clusterInx;
+    r.memberInx = memberInx;
+    r.range = rangeTo;
+    return r;
+}
+
+// unites 2 sets of ranges from 2 clusters and records them to new united cluster
+int uniteRangesInClusters(Cluster* clusterA, Cluster* clusterB, Cluster* unitedCluster)
+{
+    // init tmp variable used inside the function
+    int writtenCount = 0;
+
+    // allocating tmp range array for united cluster list
+    Range* tmp1 = malloc(sizeof(Range)*(clusterA->rangeCount + clusterB->rangeCount));
+
+    // unsuccessful allocation check
+    if (tmp1 == NULL)
+    {
+        return 1;
+    }
+
+    // recording only shortest ranges, ranges to flows of the other cluster have no pair,
+    // so they are left out (first range does not have to be the one between united clusters)
+    for (int i = 0; i < clusterA->rangeCount; i++)
+    {
+        for (int j = 0; j < clusterB->rangeCount; j++)
+        {
+            if (clusterA->ranges[i].clusterInx == clusterB->ranges[j].clusterInx)
+            {
+                if (compareRanges(&clusterB->ranges[j], &clusterA->ranges[i]) < 0)
+                {
+                    tmp1[writtenCount] = clusterB->ranges[j];
+                }
+                else
+                {
+                    tmp1[writtenCount] = clusterA->ranges[i];
+                }
+                writtenCount++;
+                break;
+            }
+        }
+    }
+
+    if (writtenCount == 0)
+    {
+        unitedCluster->rangeCount = 1;
+    }
+    else
+    {
+        unitedCluster->rangeCount = writtenCount;
+    }
+
+    // allocating tmp range array for united cluster list
+    Range* tmp = realloc(tmp1, sizeof(Range)*(unitedCluster->rangeCount));
+
+
+
+    // unsuccessful allocation check
+    if (tmp == NULL)
+    {
+        free(tmp1);
+        return 1;
+    }
+
+    // putting new range array to united cluster
+    unitedCluster->ranges = tmp;
+
+    // sot ranges inside cluster
+    sortRangesInCluster(unitedCluster);
+
+    return 0;
+}
+
+// unites 2 clusters
+Cluster uniteClusters(Cluster clusterA, Cluster clusterB)
+{
+    // create cluster type variable
+    Cluster cluster;
+    cluster.rangeCount = 0;
+    cluster.ranges = NULL;
+
+    // alloc memory for flows from both clusters
+    cluster.flowCount = clusterA.flowCount + clusterB.flowCount;
+    cluster.flows = malloc(sizeof(Flow)*cluster.flowCount);
+    cluster.stats = clusterA.stats != NULL ? malloc(sizeof(ClusterStats)) : NULL;
+
+    // unsuccessful allocation check
+    if (cluster.flows == NULL || (clusterA.stats != NULL && cluster.stats == NULL))
+    {
+        fprintf(stderr, "ERROR alloc failed\n");
+        free(cluster.flows);
+        free(cluster.stats);
+        cluster.flowCount = -1;
+        return cluster;
+    }
+
+    // stats are united without going through flows
+    if (cluster.stats != NULL)
+    {
+        *cluster.stats = uniteStats(*clusterA.stats, *clusterB.stats);
+    }
+
+    // flows of both clusters are already sorted, so they are merged in linear time
+    int a = 0;
+    int b = 0;
+    for (int i = 0; i < cluster.flowCount; i++)
+    {
+        if (b == clusterB.flowCount ||
+            (a < clusterA.flowCount && clusterA.flows[a].flowID <= clusterB.flows[b].flowID))
+        {
+            cluster.flows[i] = clusterA.flows[a];
+            a++;
+        }
+        else
+        {
+            cluster.flows[i] = clusterB.flows[b];
+            b++;
+        }
+    }
+    return cluster;
+}
+
+// prepares cluster for delete
+void prepareForDelete(Cluster* cluster, bool rangesCalculated)
+{
+    // frees flow array of cluster
+    free(cluster->flows);
+
+    // replaces pointer with NULL
+    cluster->flows = NULL;
+    free(cluster->stats);
+    cluster->stats = NULL;
+
+    // marks cluster as empty changing its flowCount with -1
+    cluster->flowCount = -1;
+
+    //if ranges were calculated, free range array (rows of range matrix are freed with it)
+    if (rangesCalculated)
+    {
+        if (!isInsideLargeBuffer(cluster->ranges))
+        {
+            free(cluster->ranges);
+        }
+        cluster->ranges = NULL;
+    }
+}
+
+// prepares clusterArr for deletion
+void prepareClusterArrForDeletion(Cluster *clusterArr, int allocClustersCount)
+{
+    for (int j = 0; j < allocClustersCount; j++)
+    {
+        prepareForDelete(&clusterArr[j], 0);
+    }
+}
+
+// unites 2 clusters and deletes originals
+int uniteAndDelete(ClusterStorage* storage, Cluster *clusterA, Cluster *clusterB, double range)
+{
+    // call function which creates united cluster
+    Cluster unitedCluster = uniteClusters(*clusterA, *clusterB);
+
+    // if united cluster is marked with -1 - break
+    if (unitedCluster.flowCount == -1)
+    {
+        return 1;
+    }
+    if (unitedCluster.stats != NULL)
+    {
+        unitedCluster.stats->mergeHeight = range;
+    }
+
+    // if error appeared while uniting ranges - break
+    if (uniteRangesInClusters(clusterA, clusterB, &unitedCluster) == 1)
+    {
+        return 1;
+    }
+
+    // prepares united clusters for deletion
+    prepareForDelete(clusterA, 1);
+    prepareForDelete(clusterB, 1);
+
+    // sorting clusters by flowCount from biggest to smallest,
+    // so empty clusters marked with flowCount -1 will be in the end
+    sortClustersFlowCount(storage->clusters, storage->clusterCount);
+
+    // update clusterCount
+    (storage->clusterCount)--;
+
+    // append united cluster to end of array
+    storage->clusters[(storage->clusterCount)-1] = unitedCluster;
+
+    // realloc to new address
+    Cluster *tmp = realloc(storage->clusters, sizeof(Cluster)*storage->clusterCount);
+    // unsuccessful allocation check
+    if (tmp == NULL)
+    {
+        fprintf(stderr, "ERROR alloc failed\n");
+        return 1;
+    }
+    else
+    {
+        storage->clusters = tmp;
+    }
+    return 0;
+}
+
+// finds range between 2 flows feature by feature, features with zero weight are skipped
+// and difference of infinite features counts as infinite, so result is always a number
+double findRangeOfInfinite(Flow flowA, Flow flowB, Weights weights)
+{
+    double sum = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        if (getWeight(weights, k) == 0)
+        {
+            continue;
+        }
+        double term = getWeight(weights, k)*squareFloat(getFeature(flowA, k) - getFeature(flowB, k));
+        sum += isnan(term) ? INFINITY : term;
+    }
+    return sqrt(sum);
+}
+
+// finds range between 2 netDots
+double findRange(Flow flowA, Flow flowB, Weights weights)
+{
+    // integer differences are squared as doubles, since their squares overflow int
+    double range = sqrt(
+    weights.bytes*squareFloat((double)flowA.totalBytes - flowB.totalBytes) +
+    weights.duration*squareFloat((double)flowA.flowDuration - flowB.flowDuration) +
+    weights.interTime*squareFloat(flowA.avgInterTime - flowB.avgInterTime) +
+    weights.interLength* squareFloat(flowA.avgInterLength - flowB.avgInterLength)
+    );
+
+    // zero weight of infinite feature gives range which is not a number, engines can not order it
+    return isnan(range) ? findRangeOfInfinite(flowA, flowB, weights) : range;
+}
+
+// Functions for calculating ranges between all pairs of clusters
+// -------------------------------------------------------------------------------------
+
+// records range between clusters a and b (a < b) to range arrays of both
+// (range arrays skip cluster itself, so index of bigger cluster is smaller by 1)
+void recordRangePair(ClusterStorage* storage, int a, int b, double range)
+{
+    storage->clusters[a].ranges[b-1] = initRange(b, a, range);
+    storage->clusters[b].ranges[a] = initRange(a, b, range);
+}
+
+// structure for sharing range matrix work between tasks
+typedef struct SRangeJob
+{
+    ClusterStorage* storage;
+    Weights weights;
+}RangeJob;
+
+// records ranges of part of 64 rows wide blocks, every pair is written to its own places,
+// so blocks can be calculated at the same time
+void recordRangeRowBlocks(void* context, int begin, int end)
+{
+    RangeJob* job = context;
+    ClusterStorage* storage = job->storage;
+    int count = storage->clusterCount;
+
+    for (int block = begin; block < end; block++)
+    {
+        TRACE_START(traceStart);
+        int rowBegin = block*64;
+        int rowEnd = rowBegin + 64 < count ? rowBegin + 64 : count;
+        for (int i = rowBegin; i < rowEnd; i++)
+        {
+            for (int n = i + 1; n < count; n++)
+            {
+                recordRangePair(storage, i, n,
+                    findRange(storage->clusters[n].flows[0], storage->clusters[i].flows[0], job->weights));
+            }
+        }
+        TRACE_SPAN("distance block", traceStart, rowEnd - rowBegin, count - rowBegin, NAN, -1);
+    }
+}
+
+// records ranges between all pairs of clusters calculating every range directly from flows,
+// blocks of rows are calculated in parallel and every pair is calculated only once
+void recordExactRanges(ClusterStorage* storage, Weights weights)
+{
+    RangeJob job;
+    job.storage = storage;
+    job.weights = weights;
+    parallelFor((storage->clusterCount + 63)/64, 1, recordRangeRowBlocks, &job);
+}
+
+// releases range matrix, clusters which were not united still have their rows in it,
+// so they are left without ranges
+void releaseRangeMatrix(ClusterStorage* storage, Range* matrix)
+{
+    for (int i = 0; i < storage->clusterCount; i++)
+    {
+        if (storage->clusters[i].flowCount != -1 && isInsideLargeBuffer(storage->clusters[i].ranges))
+        {
+            storage->clusters[i].ranges = NULL;
+        }
+    }
+    freeLarge(matrix);
+}
+
+// calculates and records ranges to dedicated structures for all clusters in given storage,
+// range arrays are rows of one large matrix, which is released by releaseRangeMatrix
+int calculateAndRecordRanges(ClusterStorage* storage, Weights weights, Range** matrix)
+{
+    size_t rowSize = (size_t)storage->clusterCount - 1;
+    *matrix = allocateLarge(sizeof(Range)*rowSize*storage->clusterCount, "range matrix");
+
+    // allocation check
+    if (*matrix == NULL)
+    {
+        return 1;
+    }
+    for (int i = 0; i < storage->clusterCount; i++)
+    {
+        storage->clusters[i].rangeCount = storage->clusterCount-1;
+        storage->clusters[i].ranges = *matrix + rowSize*i;
+    }
+
+    TRACE_START(traceStart);
+    recordExactRanges(storage, weights);
+
+    //sorting ranges inside every cluster
+    for (int i = 0; i < storage->clusterCount; i++)
+    {
+        sortRangesInCluster(&storage->clusters[i]);
+    }
+    TRACE_SPAN("ranges", traceStart, -1, -1, NAN, storage->clusterCount);
+    return 0;
+}
+
+// finds closest pair of clusters and returns array with united cluster,
+// if closest pair is farther than maxDistance (when it is not negative) marks it in isTooFar
+int findClosestAndUnite(ClusterStorage* storage, double maxDistance, bool* isTooFar)
+{
+    TRACE_START(traceStart);
+
+    // sorting all clusters by shortest range so first 2 will be the nearest pair
+    sortClustersByRange(storage);
+
+    // closest pair is too far, so nothing more should be united
+    if (maxDistance >= 0 && storage->clusters[0].ranges[0].range > maxDistance)
+    {
+        *isTooFar = true;
+        return 0;
+    }
+
+    // equal ranges are ordered by indexes of clusters they link, so the shortest range
+    // is shortest one of exactly 2 clusters, which it links, and they are on first 2 places
+    recordMerge(storage->clusters[0].flows[0].flowID, storage->clusters[1].flows[0].flowID,
+        storage->clusters[0].ranges[0].range);
+    TRACE_KEEP(int, traceSizeA, storage->clusters[0].flowCount);
+    TRACE_KEEP(int, traceSizeB, storage->clusters[1].flowCount);
+    TRACE_KEEP(double, traceRange, storage->clusters[0].ranges[0].range);
+
+    // unites found pair and appends it to cluster storage, and checks, if everything is ok
+    if (uniteAndDelete(storage, &storage->clusters[0], &storage->clusters[1], storage->clusters[0].ranges[0].range) != 0)
+    {
+        return 1;
+    }
+    TRACE_SPAN("merge", traceStart, traceSizeA, traceSizeB, traceRange, storage->clusterCount);
+    return 0;
+}
+
+// finds and unites clusters until their number reaches wanted count
+// or closest pair is farther than maxDistance
+int uniteToNGroups(int destClusterCount, ClusterStorage* storage, Weights weights, Options options)
+{
+    // checking if destination cluster count is smaller or equal too actual cluster count
+    // (storage is freed by caller)
+    if (destClusterCount > storage->clusterCount)
+    {
+        return 1;
+    }
+    // in case we need only to write sorted clusters, we only sort clusters by flowID
+    if (destClusterCount == -1)
+    {
+        // sorts clusters in storage
+        sortClustersByID(storage->clusters, storage->clusterCount);
+        return 0;
+    }
+    // if start count of clusters and destinations ones are not same
+    // starts cycle which finds and unites cluster
+    // to the point when destination is reached
+    if (destClusterCount != storage->clusterCount)
+    {
+        Range* matrix;
+        if (calculateAndRecordRanges(storage, weights, &matrix) == 1)
+        {
+            return 1;
+        }
+        bool isTooFar = false;
+        do
+        {
+            if (findClosestAndUnite(storage, options.maxDistance, &isTooFar) != 0)
+            {
+                releaseRangeMatrix(storage, matrix);
+                return 1;
+            }
+        }
+        while (destClusterCount != storage->clusterCount && !isTooFar);
+        releaseRangeMatrix(storage, matrix);
+    }
+
+    // sorts clusters in storage
+    sortClustersByID(storage->clusters, storage->clusterCount);
+    return 0;
+}
+
+// Functions for uniting clusters using minimum spanning tree
+// -------------------------------------------------------------------------------------
+
+// finds root of cluster's set in union-find array (halves path on the way)
+int findRoot(int* parent, int i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+// inits edge between 2 flows, smaller index is always first
+Edge initEdge(int flowA, int flowB, double range)
+{
+    Edge edge;
+    edge.clusterA = flowA < flowB ? flowA : flowB;
+    edge.clusterB = flowA < flowB ? flowB : flowA;
+    edge.range = range;
+    return edge;
+}
+
+// checks if edge a is shorter than edge b in same order which is used for sorting edges
+bool isShorterEdge(Edge a, Edge b)
+{
+    return compareEdges(&a, &b) < 0;
+}
+
+// checks if edge is only marker of edge which was not found yet (it links flow with itself),
+// so even edge of infinite range is taken instead of it
+bool isMissingEdge(Edge edge)
+{
+    return edge.clusterA == edge.clusterB;
+}
+
+// builds minimum spanning tree over first flows of all clusters (Prim's algorithm),
+// edges have to be allocated for clusterCount-1 edges
+int buildSpanningTree(ClusterStorage* storage, Weights weights, Edge* edges)
+{
+    int count = storage->clusterCount;
+
+    // closest edge from tree to every cluster, edges are compared in order used for sorting them,
+    // so equal ranges give same tree as in other engines
+    Edge* closest = malloc(sizeof(Edge)*count);
+    bool* isInTree = calloc(count, sizeof(bool));
+
+    // allocation check
+    if (closest == NULL || isInTree == NULL)
+    {
+        free(closest);
+        free(isInTree);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        closest[i] = initEdge(i, i, INFINITY);
+    }
+
+    // tree grows from first cluster
+    int added = 0;
+    isInTree[0] = true;
+    for (int step = 1; step < count; step++)
+    {
+        // updates closest edges with cluster added last and finds the closest one
+        int next = -1;
+        for (int i = 0; i < count; i++)
+        {
+            if (isInTree[i])
+            {
+                continue;
+            }
+            // cluster without link to tree takes even infinite range
+            Edge edge = initEdge(added, i, findRange(storage->clusters[added].flows[0], storage->clusters[i].flows[0], weights));
+            if (isMissingEdge(closest[i]) || isShorterEdge(edge, closest[i]))
+            {
+                closest[i] = edge;
+            }
+            if (next == -1 || isShorterEdge(closest[i], closest[next]))
+            {
+                next = i;
+            }
+        }
+
+        // records edge to the closest cluster and adds it to tree
+        edges[step-1] = closest[next];
+        isInTree[next] = true;
+        added = next;
+    }
+
+    free(closest);
+    free(isInTree);
+    return 0;
+}
+
+// replaces clusters in storage with clusters made from all clusters having same root
+int collapseClustersByRoots(ClusterStorage* storage, int* parent, double* heights)
+{
+    int count = storage->clusterCount;
+    int* groupOf = malloc(sizeof(int)*count);
+    int* groupSize = calloc(count, sizeof(int));
+
+    // allocation check
+    if (groupOf == NULL || groupSize == NULL)
+    {
+        free(groupOf);
+        free(groupSize);
+        return 1;
+    }
+
+    // numbers groups in order of their roots
+    int groupCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        groupOf[i] = -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int root = findRoot(parent, i);
+        if (groupOf[root] == -1)
+        {
+            groupOf[root] = groupCount;
+            groupCount++;
+        }
+        groupSize[groupOf[root]] += storage->clusters[i].flowCount;
+    }
+
+    Cluster* groups = malloc(sizeof(Cluster)*groupCount);
+
+    // allocation check
+    if (groups == NULL)
+    {
+        free(groupOf);
+        free(groupSize);
+        return 1;
+    }
+
+    // allocates every group's flow array, filled count is stored in flowCount
+    bool hasStats = count > 0 && storage->clusters[0].stats != NULL;
+    for (int g = 0; g < groupCount; g++)
+    {
+        groups[g].flowCount = 0;
+        groups[g].rangeCount = 0;
+        groups[g].ranges = NULL;
+        groups[g].flows = malloc(sizeof(Flow)*groupSize[g]);
+        groups[g].stats = hasStats ? malloc(sizeof(ClusterStats)) : NULL;
+        if (groups[g].flows == NULL || (hasStats && groups[g].stats == NULL))
+        {
+            prepareClusterArrForDeletion(groups, g + 1);
+            free(groups);
+            free(groupOf);
+            free(groupSize);
+            return 1;
+        }
+        if (hasStats)
+        {
+            *groups[g].stats = initEmptyStats();
+        }
+    }
+
+    // moves flows of every cluster to its group
+    for (int i = 0; i < count; i++)
+    {
+        int root = findRoot(parent, i);
+        Cluster* group = &groups[groupOf[root]];
+        if (hasStats)
+        {
+            *group->stats = uniteStats(*group->stats, *storage->clusters[i].stats);
+            group->stats->mergeHeight = heights[root];
+        }
+        for (int n = 0; n < storage->clusters[i].flowCount; n++)
+        {
+            group->flows[group->flowCount] = storage->clusters[i].flows[n];
+            group->flowCount++;
+        }
+    }
+
+    for (int g = 0; g < groupCount; g++)
+    {
+        sortFlowsByID(groups[g].flows, groups[g].flowCount);
+    }
+
+    // replaces original clusters with united ones
+    prepareClusterArrForDeletion(storage->clusters, count);
+    free(storage->clusters);
+    storage->clusters = groups;
+    storage->clusterCount = groupCount;
+
+    free(groupOf);
+    free(groupSize);
+    return 0;
+}
+
+// unites clusters along edges of spanning tree from shortest to longest
+// until wanted count is reached or next edge is longer than maxDistance
+int cutSpanningTree(ClusterStorage* storage, Edge* edges, int destClusterCount, double maxDistance)
+{
+    int* parent = malloc(sizeof(int)*storage->clusterCount);
+    double* heights = malloc(sizeof(double)*storage->clusterCount);
+
+    // allocation check
+    if (parent == NULL || heights == NULL)
+    {
+        free(parent);
+        free(heights);
+        return 1;
+    }
+
+    // height of every set is kept at its root
+    for (int i = 0; i < storage->clusterCount; i++)
+    {
+        parent[i] = i;
+        heights[i] = storage->clusters[i].stats != NULL ? storage->clusters[i].stats->mergeHeight : 0;
+    }
+
+    // since there is single linkage, every edge of tree unites 2 different clusters
+    TRACE_START(traceStart);
+    sortEdges(edges, storage->clusterCount-1);
+    int clusterCount = storage->clusterCount;
+    for (int i = 0; i < storage->clusterCount-1 && clusterCount > destClusterCount; i++)
+    {
+        if (maxDistance >= 0 && edges[i].range > maxDistance)
+        {
+            break;
+        }
+        int rootA = findRoot(parent, edges[i].clusterA);
+        int rootB = findRoot(parent, edges[i].clusterB);
+        parent[rootA] = rootB;
+        double height = edges[i].range > heights[rootA] ? edges[i].range : heights[rootA];
+        heights[rootB] = heights[rootB] > height ? heights[rootB] : height;
+        clusterCount--;
+        recordMerge(storage->clusters[edges[i].clusterA].flows[0].flowID,
+            storage->clusters[edges[i].clusterB].flows[0].flowID, edges[i].range);
+        TRACE_MARK("tree merge", -1, -1, edges[i].range, clusterCount);
+    }
+
+    int result = collapseClustersByRoots(storage, parent, heights);
+    free(parent);
+    free(heights);
+    TRACE_SPAN("tree cut", traceStart, -1, -1, NAN, storage->clusterCount);
+    return result;
+}
+
+// unites clusters to wanted count with single pass over sorted edges of minimum spanning tree
+int uniteWithSpanningTree(int destClusterCount, ClusterStorage* storage, Weights weights, double maxDistance)
+{
+    Edge* edges = malloc(sizeof(Edge)*storage->clusterCount);
+
+    // allocation check
+    if (edges == NULL)
+    {
+        return 1;
+    }
+
+    TRACE_START(traceStart);
+    if (buildSpanningTree(storage, weights, edges) != 0)
+    {
+        free(edges);
+        return 1;
+    }
+    TRACE_SPAN("spanning tree", traceStart, -1, -1, NAN, storage->clusterCount);
+
+    if (cutSpanningTree(storage, edges, destClusterCount, maxDistance) != 0)
+    {
+        free(edges);
+        return 1;
+    }
+
+    free(edges);
+    return 0;
+}
+
+// Functions for uniting clusters in rounds of nearest neighbour merges
+// -------------------------------------------------------------------------------------
+
+// finds root in union-find array shared by threads, path is halved on the way
+int findRootAtomic(_Atomic int* parent, int i)
+{
+    while (true)
+    {
+        int up = atomic_load(&parent[i]);
+        if (up == i)
+        {
+            return i;
+        }
+        int upper = atomic_load(&parent[up]);
+
+        // failed halving is harmless, other thread just changed it first
+        atomic_compare_exchange_weak(&parent[i], &up, upper);
+        i = upper;
+    }
+}
+
+// unites sets of 2 flows without locks, returns true if they were in different sets
+bool uniteRootsAtomic(_Atomic int* parent, int a, int b)
+{
+    while (true)
+    {
+        a = findRootAtomic(parent, a);
+        b = findRootAtomic(parent, b);
+        if (a == b)
+        {
+            return false;
+        }
+
+        // bigger root is linked under smaller one, it fails if other thread linked it meanwhile
+        int child = a > b ? a : b;
+        int root = a > b ? b : a;
+        int expected = child;
+        if (atomic_compare_exchange_strong(&parent[child], &expected, root))
+        {
+            return true;
+        }
+    }
+}
+
+// offers flow at sorted position to search of flow's shortest edge, squared terms are
+// summed from the biggest weight and flow is abandoned once sum is bigger than best range,
+// returns false if projection alone is bigger, so flows farther in this direction are skipped
+bool offerNearFlow(NeighbourRound* round, int position, int other, Edge* best, WorkerStats* counters)
+{
+    const double* a = &round->sortedFeatures[(size_t)position*4];
+    const double* b = &round->sortedFeatures[(size_t)other*4];
+
+    // small tolerance covers different order of summing than in findRange,
+    // so candidates with equal range are never skipped
+    double limit = best->range*best->range*(1 + 1e-9);
+    double sum = round->sortedWeights[0]*squareFloat(a[0] - b[0]);
+    if (sum > limit)
+    {
+        return false;
+    }
+
+    int flowInx = round->order[position];
+    int otherInx = round->order[other];
+    if (round->component[otherInx] == round->component[flowInx])
+    {
+        return true;
+    }
+
+    for (int k = 1; k < 4; k++)
+    {
+        sum += round->sortedWeights[k]*squareFloat(a[k] - b[k]);
+        if (sum > limit)
+        {
+            counters->abandonedRangeCount++;
+            return true;
+        }
+    }
+
+    // range is calculated same way as in other engines, so ties are resolved same way
+    counters->fullRangeCount++;
+    Edge edge = initEdge(flowInx, otherInx, findRange(round->flows[flowInx], round->flows[otherInx], round->weights));
+    if (isMissingEdge(*best) || isShorterEdge(edge, *best))
+    {
+        *best = edge;
+    }
+    return true;
+}
+
+// returns compact difference of 2 sorted flows on axis, it is scaled by square root of weight
+double compactDifference(NeighbourRound* round, int position, int other, int k)
+{
+    if (round->compactKind == floatCompact)
+    {
+        return (double)round->compactFloats[(size_t)position*4 + k] - round->compactFloats[(size_t)other*4 + k];
+    }
+    return round->compactSteps[k]*(round->compactFixed[(size_t)position*4 + k] - round->compactFixed[(size_t)other*4 + k]);
+}
+
+// same as offerNearFlow, but compact features are used, so flow is skipped or abandoned
+// only if it is farther than best range even with the biggest error of compact features
+bool offerCompactFlow(NeighbourRound* round, int position, int other, Edge* best, WorkerStats* counters)
+{
+    double bestRange = best->range*(1 + 1e-9);
+    double projection = fabs(compactDifference(round, position, other, 0));
+    if (projection - round->axisError > bestRange)
+    {
+        return false;
+    }
+
+    int flowInx = round->order[position];
+    int otherInx = round->order[other];
+    if (round->component[otherInx] == round->component[flowInx])
+    {
+        return true;
+    }
+
+    double limit = squareFloat(bestRange + round->rangeError);
+    double sum = squareFloat(projection);
+    for (int k = 1; k < 4; k++)
+    {
+        sum += squareFloat(compactDifference(round, position, other, k));
+        if (sum > limit)
+        {
+            counters->abandonedRangeCount++;
+            return true;
+        }
+    }
+
+    // candidate near best range is checked with exact features
+    counters->fullRangeCount++;
+    Edge edge = initEdge(flowInx, otherInx, findRange(round->flows[flowInx], round->flows[otherInx], round->weights));
+    if (isMissingEdge(*best) || isShorterEdge(edge, *best))
+    {
+        *best = edge;
+    }
+    return true;
+}
+
+// offers flow with features chosen for round
+bool offerFlow(NeighbourRound* round, int position, int other, Edge* best, WorkerStats* counters)
+{
+    if (round->compactKind == noCompact)
+    {
+        return offerNearFlow(round, position, other, best, counters);
+    }
+    return offerCompactFlow(round, position, other, best, counters);
+}
+
+// finds shortest edge from every flow of part (in sorted order) to flow of other component,
+// flows are visited from the nearest projection in both directions
+void findShortestEdges(void* context, int begin, int end)
+{
+    NeighbourRound* round = context;
+    WorkerStats counters = {0};
+    TRACE_START(traceStart);
+
+    for (int position = begin; position < end; position++)
+    {
+        int flowInx = round->order[position];
+        Edge best = initEdge(flowInx, flowInx, INFINITY);
+        int down = position - 1;
+        int up = position + 1;
+        bool isDownOpen = down >= 0;
+        bool isUpOpen = up < round->flowCount;
+
+        while (isDownOpen || isUpOpen)
+        {
+            if (isDownOpen)
+            {
+                isDownOpen = offerFlow(round, position, down, &best, &counters);
+                down--;
+                isDownOpen = isDownOpen && down >= 0;
+            }
+            if (isUpOpen)
+            {
+                isUpOpen = offerFlow(round, position, up, &best, &counters);
+                up++;
+                isUpOpen = isUpOpen && up < round->flowCount;
+            }
+        }
+        counters.skippedRangeCount += (down + 1) + (round->flowCount - up);
+        round->shortest[flowInx] = best;
+    }
+
+    if (currentWorker >= 0)
+    {
+        WorkerStats* stats = &taskScheduler.stats[currentWorker];
+        stats->fullRangeCount += counters.fullRangeCount;
+        stats->abandonedRangeCount += counters.abandonedRangeCount;
+        stats->skippedRangeCount += counters.skippedRangeCount;
+    }
+    TRACE_SPAN("distance block", traceStart, end - begin, round->flowCount, NAN, -1);
+}
+
+// unites components along part of found candidate edges at the same time
+void uniteCandidates(void* context, int begin, int end)
+{
+    NeighbourRound* round = context;
+
+    for (int i = begin; i < end; i++)
+    {
+        Edge edge = round->candidates[i];
+
+        // mutual nearest neighbours find the same edge, it is added only once
+        if (uniteRootsAtomic(round->parent, edge.clusterA, edge.clusterB))
+        {
+            round->edges[atomic_fetch_add(&round->edgeCount, 1)] = edge;
+        }
+    }
+}
+
+// finds roots of part of flows
+void findComponents(void* context, int begin, int end)
+{
+    NeighbourRound* round = context;
+
+    for (int i = begin; i < end; i++)
+    {
+        round->component[i] = findRootAtomic(round->parent, i);
+    }
+}
+
+// frees arrays of nearest neighbour rounds
+void freeNeighbourRound(NeighbourRound* round)
+{
+    free(round->flows);
+    free(round->order);
+    freeLarge(round->sortedFeatures);
+    freeLarge(round->compactFloats);
+    freeLarge(round->compactFixed);
+    free(round->parent);
+    free(round->component);
+    free(round->shortest);
+    free(round->candidates);
+    free(round->edges);
+}
+
+// orders flows of round by feature with the biggest weight and stores their features
+// from the biggest weight, returns 1 if allocation failed
+int sortRoundFlows(NeighbourRound* round)
+{
+    int axes[4] = {0, 1, 2, 3};
+    for (int k = 1; k < 4; k++)
+    {
+        for (int n = k; n > 0 && getWeight(round->weights, axes[n]) > getWeight(round->weights, axes[n-1]); n--)
+        {
+            int tmp = axes[n];
+            axes[n] = axes[n-1];
+            axes[n-1] = tmp;
+        }
+    }
+    for (int k = 0; k < 4; k++)
+    {
+        round->sortedWeights[k] = getWeight(round->weights, axes[k]);
+    }
+
+    ProjectedFlow* projected = malloc(sizeof(ProjectedFlow)*round->flowCount);
+    if (projected == NULL)
+    {
+        return 1;
+    }
+    for (int i = 0; i < round->flowCount; i++)
+    {
+        projected[i].projection = getFeature(round->flows[i], axes[0]);
+        projected[i].flowInx = i;
+    }
+    qsort(projected, round->flowCount, sizeof(ProjectedFlow), compareProjectedFlows);
+
+    for (int position = 0; position < round->flowCount; position++)
+    {
+        int flowInx = projected[position].flowInx;
+        round->order[position] = flowInx;
+        for (int k = 0; k < 4; k++)
+        {
+            round->sortedFeatures[(size_t)position*4 + k] = getFeature(round->flows[flowInx], axes[k]);
+        }
+    }
+    free(projected);
+    return 0;
+}
+
+// stores sorted features of round in compact form, features are centered on every axis
+// and scaled by square roots of weights, errors of compact ranges are bounded,
+// returns 1 if allocation failed
+int compactRoundFeatures(NeighbourRound* round)
+{
+    int count = round->flowCount;
+    double centers[4];
+    double halfWidths[4];
+    for (int k = 0; k < 4; k++)
+    {
+        double low = INFINITY;
+        double high = -INFINITY;
+        for (int i = 0; i < count; i++)
+        {
+            double value = round->sortedFeatures[(size_t)i*4 + k];
+            low = value < low ? value : low;
+            high = value > high ? value : high;
+        }
+        centers[k] = (low + high)/2;
+        halfWidths[k] = sqrt(round->sortedWeights[k])*(high - low)/2;
+    }
+
+    // difference on one axis is wrong by at most 2 rounding errors of compact values
+    double axisErrors[4];
+    if (round->compactKind == floatCompact)
+    {
+        round->compactFloats = allocateLarge(sizeof(float)*4*count, "compact features");
+        if (round->compactFloats == NULL)
+        {
+            return 1;
+        }
+        for (int k = 0; k < 4; k++)
+        {
+            axisErrors[k] = 2*halfWidths[k]*FLT_EPSILON;
+        }
+    }
+    else
+    {
+        round->compactFixed = allocateLarge(sizeof(int16_t)*4*count, "compact features");
+        if (round->compactFixed == NULL)
+        {
+            return 1;
+        }
+        for (int k = 0; k < 4; k++)
+        {
+            round->compactSteps[k] = halfWidths[k]/INT16_MAX;
+            axisErrors[k] = round->compactSteps[k];
+        }
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            double scaled = sqrt(round->sortedWeights[k])*(round->sortedFeatures[(size_t)i*4 + k] - centers[k]);
+            if (round->compactKind == floatCompact)
+            {
+                round->compactFloats[(size_t)i*4 + k] = (float)scaled;
+            }
+            else
+            {
+                round->compactFixed[(size_t)i*4 + k] = round->compactSteps[k] > 0 ?
+                    (int16_t)lround(scaled/round->compactSteps[k]) : 0;
+            }
+        }
+    }
+
+    // errors are slightly enlarged, since scaling in doubles is not exact either
+    round->axisError = axisErrors[0]*1.01;
+    round->rangeError = sqrt(squareFloat(axisErrors[0]) + squareFloat(axisErrors[1]) +
+        squareFloat(axisErrors[2]) + squareFloat(axisErrors[3]))*1.01;
+
+    // exact features are not needed anymore, only the compact ones are searched
+    freeLarge(round->sortedFeatures);
+    round->sortedFeatures = NULL;
+    return 0;
+}
+
+// builds minimum spanning tree in rounds, in every round each component finds
+// its nearest neighbour in parallel and all of them are united at once;
+// these are edges of the tree (mutual nearest neighbours share one edge),
+// so result is same as sequential one, and component count is at least halved
+int buildTreeInRounds(ClusterStorage* storage, Weights weights, int compactKind, Edge* treeEdges)
+{
+    int count = storage->clusterCount;
+    NeighbourRound round;
+    round.flowCount = count;
+    round.weights = weights;
+    round.compactKind = compactKind;
+    round.compactFloats = NULL;
+    round.compactFixed = NULL;
+    round.flows = malloc(sizeof(Flow)*count);
+    round.order = malloc(sizeof(int)*count);
+    round.sortedFeatures = allocateLarge(sizeof(double)*4*count, "sorted features");
+    round.parent = malloc(sizeof(_Atomic int)*count);
+    round.component = malloc(sizeof(int)*count);
+    round.shortest = malloc(sizeof(Edge)*count);
+    round.candidates = malloc(sizeof(Edge)*count);
+    round.edges = treeEdges;
+    atomic_init(&round.edgeCount, 0);
+
+    // allocation check
+    if (round.flows == NULL || round.order == NULL || round.sortedFeatures == NULL || round.parent == NULL ||
+        round.component == NULL || round.shortest == NULL || round.candidates == NULL)
+    {
+        round.edges = NULL;
+        freeNeighbourRound(&round);
+        return 1;
+    }
+
+    // first flows of clusters are copied to one array, so they are close in memory
+    for (int i = 0; i < count; i++)
+    {
+        round.flows[i] = storage->clusters[i].flows[0];
+        atomic_init(&round.parent[i], i);
+    }
+    if (sortRoundFlows(&round) != 0 || (compactKind != noCompact && compactRoundFeatures(&round) != 0))
+    {
+        round.edges = NULL;
+        freeNeighbourRound(&round);
+        return 1;
+    }
+
+    while (atomic_load(&round.edgeCount) < count - 1)
+    {
+        TRACE_START(traceStart);
+        int edgeCount = atomic_load(&round.edgeCount);
+        parallelFor(count, 256, findComponents, &round);
+        parallelFor(count, 16, findShortestEdges, &round);
+
+        // shortest edge of every component is the shortest edge of its flows
+        for (int i = 0; i < count; i++)
+        {
+            round.candidates[i] = initEdge(i, i, INFINITY);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int root = round.component[i];
+            if (!isMissingEdge(round.shortest[i]) &&
+                (isMissingEdge(round.candidates[root]) || isShorterEdge(round.shortest[i], round.candidates[root])))
+            {
+                round.candidates[root] = round.shortest[i];
+            }
+        }
+        round.candidateCount = 0;
+        for (int i = 0; i < count; i++)
+        {
+            if (round.component[i] == i && !isMissingEdge(round.candidates[i]))
+            {
+                round.candidates[round.candidateCount] = round.candidates[i];
+                round.candidateCount++;
+            }
+        }
+
+        parallelFor(round.candidateCount, 64, uniteCandidates, &round);
+
+        // ranges which are not numbers (infinite features with zero weight) can not be compared,
+        // so if round added no edge, remaining components are linked by infinite edges
+        if (atomic_load(&round.edgeCount) == edgeCount)
+        {
+            for (int i = 1; i < count; i++)
+            {
+                if (uniteRootsAtomic(round.parent, 0, i))
+                {
+                    round.edges[atomic_fetch_add(&round.edgeCount, 1)] = initEdge(0, i, INFINITY);
+                }
+            }
+        }
+        TRACE_SPAN("round", traceStart, -1, -1, NAN, count - atomic_load(&round.edgeCount));
+    }
+
+    round.edges = NULL;
+    freeNeighbourRound(&round);
+    return 0;
+}
+
+// unites clusters to wanted count using spanning tree built in parallel rounds
+int uniteInNeighbourRounds(int destClusterCount, ClusterStorage* storage, Weights weights, Options options)
+{
+    Edge* edges = malloc(sizeof(Edge)*storage->clusterCount);
+
+    // allocation check
+    if (edges == NULL)
+    {
+        return 1;
+    }
+
+    if (buildTreeInRounds(storage, weights, options.compactKind, edges) != 0 ||
+        cutSpanningTree(storage, edges, destClusterCount, options.maxDistance) != 0)
+    {
+        free(edges);
+        return 1;
+    }
+
+    free(edges);
+    return 0;
+}
+
+// unites clusters using engine chosen in options
+int uniteWithEngine(int destClusterCount, ClusterStorage* storage, Weights weights, Options options)
+{
+    // only sorting is needed, or wanted count is not reachable,
+    // both cases are handled by reference engine
+    if (options.engine == referenceEngine || destClusterCount == -1 ||
+        destClusterCount >= storage->clusterCount)
+    {
+        return uniteToNGroups(destClusterCount, storage, weights, options);
+    }
+
+    int result;
+    if (options.engine == nearestRoundsEngine)
+    {
+        result = uniteInNeighbourRounds(destClusterCount, storage, weights, options);
+    }
+    else
+    {
+        result = uniteWithSpanningTree(destClusterCount, storage, weights, options.maxDistance);
+    }
+    if (result != 0)
+    {
+        return 1;
+    }
+
+    // sorts clusters in storage
+    sortClustersByID(storage->clusters, storage->clusterCount);
+    return 0;
+}
+
+// prints info about exact cluster to given output
+void clusterOut(FILE* out, Cluster cluster, int clusterInx)
+{
+    fprintf(out, "cluster %i: ", clusterInx);
+
+    for (int i = 0; i < cluster.flowCount; i++)
+    {
+        fprintf(out, "%i ", cluster.flows[i].flowID);
+    }
+    fprintf(out, "\n");
+}
+
+// prints info about all clusters to given output
+void infoOut(FILE* out, ClusterStorage storage)
+{
+    fprintf(out, "Clusters:\n");
+
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        clusterOut(out, storage.clusters[i], i);
+    }
+}
+
+// prints aggregates of every cluster to given output
+void clusterStatsOut(FILE* out, ClusterStorage storage)
+{
+    const char* featureNames[4] = {"bytes", "duration", "inter-time", "inter-length"};
+    fprintf(out, "Cluster stats (sum/mean/min/max):\n");
+
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        ClusterStats stats = *storage.clusters[i].stats;
+        int count = storage.clusters[i].flowCount;
+        fprintf(out, "cluster %i: count %i, height %g", i, count, stats.mergeHeight);
+        for (int k = 0; k < 4; k++)
+        {
+            fprintf(out, ", %s %g/%g/%g/%g", featureNames[k], stats.sums[k], stats.sums[k]/count,
+                stats.mins[k], stats.maxs[k]);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+// prints clusters and their aggregates if they were asked
+void resultOut(FILE* out, ClusterStorage storage, Options options)
+{
+    TRACE_START(traceStart);
+    infoOut(out, storage);
+    if (options.printClusterStats)
+    {
+        clusterStatsOut(out, storage);
+    }
+    TRACE_SPAN("output", traceStart, -1, -1, NAN, storage.clusterCount);
+}
+
+// controlls if IP is relevant and stores source and destination addresses as 32-bit numbers
+int controlIP(FILE* srcFile, uint32_t* srcIP, uint32_t* dstIP)
+{
+    int tmpIP[4];
+    uint32_t* addresses[2] = {srcIP, dstIP};
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (fscanf(srcFile, "%i.%i.%i.%i ", &tmpIP[0], &tmpIP[1], &tmpIP[2], &tmpIP[3]) != 4)
+            return 1;
+
+        *addresses[i] = 0;
+        for (int n = 0; n < 4; n++)
+        {
+            if (!(tmpIP[n] >= 0 && tmpIP[n] < 256))
+                return 1;
+            *addresses[i] = (*addresses[i] << 8) | (uint32_t)tmpIP[n];
+        }
+    }
+    return 0;
+}
+
+// Functions for deduplication of flows with identical features
+// -------------------------------------------------------------------------------------
+
+// checks if 2 flows have same features (flowIDs are not compared), flows with infinite
+// features are infinitely far even from identical ones, so they are never same
+bool haveSameFeatures(Flow flowA, Flow flowB)
+{
+    return isfinite(flowA.avgInterTime) && isfinite(flowA.avgInterLength) &&
+        flowA.totalBytes == flowB.totalBytes &&
+        flowA.flowDuration == flowB.flowDuration &&
+        flowA.avgInterTime == flowB.avgInterTime &&
+        flowA.avgInterLength == flowB.avgInterLength;
+}
+
+// mixes bits of 64-bit number (splitmix64 finalizer)
+uint64_t mixBits(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// calculates hash of flow's features
+uint64_t hashFeatures(Flow flow)
+{
+    // adding 0.0 turns -0.0 into 0.0, so equal doubles get equal bits
+    double interTime = flow.avgInterTime + 0.0;
+    double interLength = flow.avgInterLength + 0.0;
+    uint64_t timeBits;
+    uint64_t lengthBits;
+    memcpy(&timeBits, &interTime, sizeof(timeBits));
+    memcpy(&lengthBits, &interLength, sizeof(lengthBits));
+
+    uint64_t hash = mixBits(((uint64_t)(uint32_t)flow.totalBytes << 32) | (uint32_t)flow.flowDuration);
+    hash = mixBits(hash ^ timeBits);
+    return mixBits(hash ^ lengthBits);
+}
+
+// frees all temporary arrays used by deduplication
+void freeDedupArrays(int* table, int* groupOf, int* groupFirst, int* groupSize, Flow* flowBuffer)
+{
+    free(table);
+    free(groupOf);
+    free(groupFirst);
+    free(groupSize);
+    free(flowBuffer);
+}
+
+// collapses clusters with identical features into one cluster,
+// which keeps flows of all its members, so the uniting works with fewer clusters
+int deduplicateClusters(ClusterStorage* storage, int destClusterCount, Weights weights)
+{
+    int count = storage->clusterCount;
+
+    // only sorting was asked or there is nothing to collapse
+    if (destClusterCount == -1 || count < 2)
+    {
+        return 0;
+    }
+
+    // with zero weight also different flows have zero range, collapsing identical ones first
+    // would change which of these equal ranges are used, so result would differ from other modes
+    if (!(weights.bytes > 0 && weights.duration > 0 && weights.interTime > 0 && weights.interLength > 0))
+    {
+        return 0;
+    }
+
+    // table size is power of 2 which is at least twice bigger than cluster count
+    size_t tableSize = 1;
+    while (tableSize < 2*(size_t)count)
+    {
+        tableSize <<= 1;
+    }
+
+    int* table = malloc(sizeof(int)*tableSize);
+    int* groupOf = malloc(sizeof(int)*count);
+    int* groupFirst = malloc(sizeof(int)*count);
+    int* groupSize = calloc(count, sizeof(int));
+    Flow* flowBuffer = NULL;
+
+    // allocation check
+    if (table == NULL || groupOf == NULL || groupFirst == NULL || groupSize == NULL)
+    {
+        freeDedupArrays(table, groupOf, groupFirst, groupSize, flowBuffer);
+        return 1;
+    }
+
+    // -1 marks empty slot, other values are group indexes
+    for (size_t i = 0; i < tableSize; i++)
+    {
+        table[i] = -1;
+    }
+
+    // finds group for every cluster using open addressing with linear probing
+    int groupCount = 0;
+    int totalFlowCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Flow flow = storage->clusters[i].flows[0];
+        size_t slot = hashFeatures(flow) & (tableSize - 1);
+
+        while (table[slot] != -1 &&
+            !haveSameFeatures(storage->clusters[groupFirst[table[slot]]].flows[0], flow))
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        // opens new group if features were not seen yet
+        if (table[slot] == -1)
+        {
+            table[slot] = groupCount;
+            groupFirst[groupCount] = i;
+            groupCount++;
+        }
+        groupOf[i] = table[slot];
+        groupSize[table[slot]] += storage->clusters[i].flowCount;
+        totalFlowCount += storage->clusters[i].flowCount;
+    }
+
+    // nothing to collapse, or collapsing would leave fewer clusters than wanted
+    if (groupCount == count || groupCount < destClusterCount)
+    {
+        freeDedupArrays(table, groupOf, groupFirst, groupSize, flowBuffer);
+        return 0;
+    }
+
+    // reuses groupFirst as offsets of groups in united flow buffer
+    int offset = 0;
+    for (int g = 0; g < groupCount; g++)
+    {
+        groupFirst[g] = offset;
+        offset += groupSize[g];
+        groupSize[g] = 0;
+    }
+
+    flowBuffer = malloc(sizeof(Flow)*totalFlowCount);
+    Cluster* groups = malloc(sizeof(Cluster)*groupCount);
+
+    // allocation check
+    if (flowBuffer == NULL || groups == NULL)
+    {
+        free(groups);
+        freeDedupArrays(table, groupOf, groupFirst, groupSize, flowBuffer);
+        return 1;
+    }
+
+    // places flows of every cluster to place of its group
+    for (int i = 0; i < count; i++)
+    {
+        int g = groupOf[i];
+
+        // identical flows are united with first cluster of their group
+        if (groupSize[g] > 0)
+        {
+            recordMerge(flowBuffer[groupFirst[g]].flowID, storage->clusters[i].flows[0].flowID, 0);
+        }
+        for (int n = 0; n < storage->clusters[i].flowCount; n++)
+        {
+            flowBuffer[groupFirst[g] + groupSize[g]] = storage->clusters[i].flows[n];
+            groupSize[g]++;
+        }
+    }
+
+    // creates one cluster for every group
+    for (int g = 0; g < groupCount; g++)
+    {
+        groups[g] = initCluster(&flowBuffer[groupFirst[g]], groupSize[g]);
+
+        if (groups[g].flowCount == -1)
+        {
+            prepareClusterArrForDeletion(groups, g);
+            free(groups);
+            freeDedupArrays(table, groupOf, groupFirst, groupSize, flowBuffer);
+            return 1;
+        }
+    }
+
+    // replaces original clusters with collapsed ones
+    prepareClusterArrForDeletion(storage->clusters, count);
+    free(storage->clusters);
+    storage->clusters = groups;
+    storage->clusterCount = groupCount;
+
+    freeDedupArrays(table, groupOf, groupFirst, groupSize, flowBuffer);
+    return 0;
+}
+
+// collapses identical flows and unites clusters in storage to wanted count
+int clusterToNGroups(int destClusterCount, ClusterStorage* storage, Weights weights, Options options)
+{
+    // collapses flows with identical features, so they are united only once
+    if (deduplicateClusters(storage, destClusterCount, weights) != 0)
+    {
+        return 1;
+    }
+
+    // starts uniting process
+    return uniteWithEngine(destClusterCount, storage, weights, options);
+}
+
+// collects optional arguments starting with "--" and removes them from argv
+int collectOptionsFromInput(int* argc, char* argv[], Options* options)
+{
+    // default values
+    options->maxDistance = -1;
+    options->engine = referenceEngine;
+    options->weights.bytes = 1;
+    options->weights.duration = 1;
+    options->weights.interTime = 1;
+    options->weights.interLength = 1;
+    options->windowSize = 0;
+    options->windowStep = 0;
+    options->partitionBy = noPartition;
+    options->partitionPrefix = 32;
+    options->compactKind = noCompact;
+    options->exportPath = NULL;
+    options->exportMerges = false;
+    options->printClusterStats = false;
+    options->weightsFile = NULL;
+    options->placementPolicy = defaultPlacement;
+    options->pageKind = smallPages;
+    options->approxEps = 0;
+    options->tracePath = NULL;
+    options->memoryLimit = 1L << 20;
+    options->threadCount = 0;
+    options->printStats = false;
+
+    int keptCount = 1;
+    for (int i = 1; i < *argc; i++)
+    {
+        // positional arguments are moved to front
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            argv[keptCount] = argv[i];
+            keptCount++;
+            continue;
+        }
+
+        // options without value
+        if (strcmp(argv[i], "--stats") == 0)
+        {
+            options->printStats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--cluster-stats") == 0)
+        {
+            options->printClusterStats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--export-merges") == 0)
+        {
+            options->exportMerges = true;
+            continue;
+        }
+
+        // every other option has value
+        if (i + 1 >= *argc)
+        {
+            return 1;
+        }
+        char* name = argv[i] + 2;
+        char* value = argv[i+1];
+        i++;
+
+        if (strcmp(name, "max-distance") == 0)
+        {
+            char *endptr;
+            options->maxDistance = strtod(value, &endptr);
+            if (*endptr != '\0' || !(options->maxDistance >= 0))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(name, "weights") == 0)
+        {
+            Weights* w = &options->weights;
+            int readCount = 0;
+            if (sscanf(value, "%lf,%lf,%lf,%lf%n", &w->bytes, &w->duration,
+                    &w->interTime, &w->interLength, &readCount) != 4 || value[readCount] != '\0' ||
+                w->bytes < 0 || w->duration < 0 || w->interTime < 0 || w->interLength < 0)
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(name, "threads") == 0)
+        {
+            char *endptr;
+            long number = strtol(value, &endptr, 10);
+            if (*endptr != '\0' || number <= 0 || number > 1024)
+            {
+                return 1;
+            }
+            options->threadCount = (int)number;
+        }
+        else if (strcmp(name, "window") == 0 || strcmp(name, "step") == 0)
+        {
+            char *endptr;
+            long number = strtol(value, &endptr, 10);
+            if (*endptr != '\0' || number <= 0 || number > INT32_MAX/2)
+            {
+                return 1;
+            }
+            if (name[0] == 'w')
+            {
+                options->windowSize = (int)number;
+            }
+            else
+            {
+                options->windowStep = (int)number;
+            }
+        }
+        else if (strcmp(name, "partition-by") == 0)
+        {
+            // kind of partition is followed by optional prefix length
+            char* prefix = strchr(value, '/');
+            size_t kindLength = prefix == NULL ? strlen(value) : (size_t)(prefix - value);
+            if (kindLength == 3 && strncmp(value, "src", 3) == 0)
+            {
+                options->partitionBy = sourcePartition;
+            }
+            else if (kindLength == 3 && strncmp(value, "dst", 3) == 0)
+            {
+                options->partitionBy = destinationPartition;
+            }
+            else if (kindLength == 4 && strncmp(value, "pair", 4) == 0)
+            {
+                options->partitionBy = pairPartition;
+            }
+            else
+            {
+                return 1;
+            }
+            if (prefix != NULL)
+            {
+                char *endptr;
+                long length = strtol(prefix + 1, &endptr, 10);
+                if (*endptr != '\0' || prefix[1] == '\0' || length < 0 || length > 32)
+                {
+                    return 1;
+                }
+                options->partitionPrefix = (int)length;
+            }
+        }
+        else if (strcmp(name, "export") == 0)
+        {
+            options->exportPath = value;
+        }
+        else if (strcmp(name, "weights-file") == 0)
+        {
+            options->weightsFile = value;
+        }
+        else if (strcmp(name, "approx") == 0)
+        {
+            char *endptr;
+            options->approxEps = strtod(value, &endptr);
+            if (*endptr != '\0' || !(options->approxEps > 0) || isinf(options->approxEps))
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(name, "trace") == 0)
+        {
+            options->tracePath = value;
+        }
+        else if (strcmp(name, "memory-limit") == 0)
+        {
+            char *endptr;
+            long number = strtol(value, &endptr, 10);
+            long unit = 1;
+            if (*endptr != '\0' && endptr[1] == '\0')
+            {
+                unit = *endptr == 'K' ? 1L << 10 : *endptr == 'M' ? 1L << 20 : *endptr == 'G' ? 1L << 30 : 0;
+                endptr++;
+            }
+            if (*endptr != '\0' || unit == 0 || number <= 0 || number > LONG_MAX/unit)
+            {
+                return 1;
+            }
+            options->memoryLimit = number*unit;
+        }
+        else if (strcmp(name, "placement") == 0)
+        {
+            // policy is followed by optional kind of pages
+            char* pages = strchr(value, '/');
+            size_t policyLength = pages == NULL ? strlen(value) : (size_t)(pages - value);
+            if (policyLength == 7 && strncmp(value, "default", 7) == 0)
+            {
+                options->placementPolicy = defaultPlacement;
+            }
+            else if (policyLength == 10 && strncmp(value, "interleave", 10) == 0)
+            {
+                options->placementPolicy = interleavePlacement;
+            }
+            else if (policyLength == 11 && strncmp(value, "first-touch", 11) == 0)
+            {
+                options->placementPolicy = firstTouchPlacement;
+            }
+            else
+            {
+                return 1;
+            }
+            if (pages != NULL)
+            {
+                if (strcmp(pages + 1, "thp") == 0)
+                {
+                    options->pageKind = transparentPages;
+                }
+                else if (strcmp(pages + 1, "hugetlb") == 0)
+                {
+                    options->pageKind = explicitPages;
+                }
+                else
+                {
+                    return 1;
+                }
+            }
+        }
+        else if (strcmp(name, "compact") == 0)
+        {
+            if (strcmp(value, "float") == 0)
+            {
+                options->compactKind = floatCompact;
+            }
+            else if (strcmp(value, "fixed16") == 0)
+            {
+                options->compactKind = fixed16Compact;
+            }
+            else
+            {
+                return 1;
+            }
+        }
+        else if (strcmp(name, "engine") == 0)
+        {
+            if (strcmp(value, "reference") == 0)
+            {
+                options->engine = referenceEngine;
+            }
+            else if (strcmp(value, "mst") == 0)
+            {
+                options->engine = spanningTreeEngine;
+            }
+            else if (strcmp(value, "mnn") == 0)
+            {
+                options->engine = nearestRoundsEngine;
+            }
+            else
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            return 1;
+        }
+    }
+    // step can not be used without window
+    if (options->windowStep != 0 && options->windowSize == 0)
+    {
+        return 1;
+    }
+    if (options->windowStep == 0)
+    {
+        options->windowStep = options->windowSize;
+    }
+
+    *argc = keptCount;
+    return 0;
+}
+
+int collectInfoFromInput(int argc, char* argv[], Weights* weights, int* destClusterCount)
+{
+    // check if argument number is correct, if not stops program with error
+    if (argc != 7)
+    {
+        //if we have only filename entered we mark it by unreal destClusterCount
+        if (argc == 2)
+        {
+            *destClusterCount = -1;
+            return 0;
+        }
+        return 1;
+    }
+
+    *destClusterCount = atoi(argv[2]);
+
+
+    // stores all given data in weights united storage
+    char *endptr;
+    weights->bytes = strtod(argv[3], &endptr);
+    weights->duration = strtod(argv[4], &endptr);
+    weights->interTime = strtod(argv[5], &endptr);
+    weights->interLength = strtod(argv[6], &endptr);
+
+    // weights control
+    if (weights->bytes < 0 ||
+        weights->duration < 0 ||
+        weights->interTime < 0 ||
+        weights->interLength < 0)
+    {
+        return 1;
+    }
+
+    // verifies if destination cluster count is legit
+    if (*destClusterCount <= 0)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+// creates cluster from source file, addresses of flows are kept only if addresses is not NULL,
+// they are stored as source and destination of every flow by its input index
+int collectInfoFromSourceFile(FILE* srcFile, ClusterStorage *clusterStorage, uint32_t** addresses)
+{
+    // init all essential variables for temporary storing data
+    int currClusterCount;
+    int flowID;
+    int totalBytes;
+    int flowDuration;
+    int packetCount;
+    double avgInterarrivalTime;
+    uint32_t srcIP;
+    uint32_t dstIP;
+
+    // finds start cluster count
+    if (fscanf(srcFile, "count=%i\n", &currClusterCount) != 1 || currClusterCount <= 0)
+    {
+        finishProgram(fileRead, 1, srcFile, 0, 0);
+        return 1;
+    }
+
+    // init cluster array on heap, since big files would not fit to stack
+    Cluster* tmpClusterArr = malloc(sizeof(Cluster)*currClusterCount);
+    uint32_t* tmpAddresses = addresses != NULL ? malloc(sizeof(uint32_t)*2*(size_t)currClusterCount) : NULL;
+
+    // unsuccessful allocation is reported by caller
+    if (tmpClusterArr == NULL || (addresses != NULL && tmpAddresses == NULL))
+    {
+        fclose(srcFile);
+        free(tmpClusterArr);
+        free(tmpAddresses);
+        clusterStorage->clusterCount = -1;
+        return 0;
+    }
+
+    // all clusters in start have only 1 flow, but intCluster function requires array,
+    // so we just sore single number in array form
+    Flow flows[1];
+
+    // traverses left source file lines scanning every line
+    // and storing important info to tmp variables
+    for (int i = 0; i < currClusterCount; i++)
+    {
+        if (fscanf(srcFile, "%i ", &flowID) != 1 || flowID < 0 || controlIP(srcFile, &srcIP, &dstIP) == 1 ||
+            fscanf(srcFile, "%i %i %i %lf\n", &totalBytes, &flowDuration, &packetCount, &avgInterarrivalTime) != 4)
+        {
+            finishProgram(fileRead, 1, srcFile, 0, 0);
+            prepareClusterArrForDeletion(tmpClusterArr, i);
+            free(tmpClusterArr);
+            free(tmpAddresses);
+            return 1;
+        }
+
+        // inits flow from tmp variables
+        flows[0] =  initFlow(flowID, i, totalBytes, flowDuration, packetCount, avgInterarrivalTime);
+        if (tmpAddresses != NULL)
+        {
+            tmpAddresses[2*i] = srcIP;
+            tmpAddresses[2*i + 1] = dstIP;
+        }
+
+        // creates cluster and appends it to temporary array
+        tmpClusterArr[i] = initCluster(flows, 1);
+
+        if (tmpClusterArr[i].flowCount == -1)
+        {
+            finishProgram(fileRead, 1, srcFile, 0, 0);
+            prepareClusterArrForDeletion(tmpClusterArr, i);
+            free(tmpClusterArr);
+            free(tmpAddresses);
+            return 1;
+        }
+    }
+    // closes file
+    fclose(srcFile);
+
+    // returns results in form of cluster storage
+    clusterStorage->clusterCount = currClusterCount;
+    clusterStorage->clusters = tmpClusterArr;
+    if (addresses != NULL)
+    {
+        *addresses = tmpAddresses;
+    }
+
+    return 0;
+}
+
+// opens file and forms cluster storage with single flow clusters from it,
+// addresses of flows are kept only if addresses is not NULL
+int loadStorageFromFile(const char* fileName, ClusterStorage* storage, uint32_t** addresses)
+{
+    // open file name of which was given
+    FILE* srcFile = fopen(fileName, "r");
+
+    // if not opened not stops program with error
+    if (srcFile == NULL)
+    {
+        finishProgram(fileOpen, 1, 0, 0, 0);
+        return 1;
+    }
+
+    TRACE_START(traceStart);
+    if (collectInfoFromSourceFile(srcFile, storage, addresses) == 1)
+        return 1;
+
+    // checking if clusterCStorage was properly allocated
+    if (storage->clusterCount == -1)
+    {
+        finishProgram(afterRead, 1, srcFile, storage, 0);
+        return 1;
+    }
+    TRACE_SPAN("parse", traceStart, -1, -1, NAN, storage->clusterCount);
+    return 0;
+}
+
+// Functions for k nearest neighbours search
+// -------------------------------------------------------------------------------------
+
+// reorders part of order array so flow with middle weighted feature is in the middle,
+// smaller ones are before it and bigger ones after it (quickselect)
+void selectMiddleFlow(KdTree* tree, int begin, int end, int axis)
+{
+    int middle = (begin + end)/2;
+    int left = begin;
+    int right = end - 1;
+
+    while (left < right)
+    {
+        double pivot = getFeature(tree->flows[tree->order[(left + right)/2]], axis);
+        int i = left;
+        int j = right;
+        while (i <= j)
+        {
+            while (getFeature(tree->flows[tree->order[i]], axis) < pivot) i++;
+            while (getFeature(tree->flows[tree->order[j]], axis) > pivot) j--;
+            if (i <= j)
+            {
+                int tmp = tree->order[i];
+                tree->order[i] = tree->order[j];
+                tree->order[j] = tmp;
+                i++;
+                j--;
+            }
+        }
+        if (middle <= j)
+        {
+            right = j;
+        }
+        else if (middle >= i)
+        {
+            left = i;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+// builds node covering given part of order array and returns its index
+int buildKdNode(KdTree* tree, int begin, int end)
+{
+    int nodeInx = tree->nodeCount;
+    tree->nodeCount++;
+
+    KdNode* node = &tree->nodes[nodeInx];
+    node->begin = begin;
+    node->end = end;
+    node->left = -1;
+    node->right = -1;
+
+    // small nodes are left as leaves
+    if (end - begin <= 8)
+    {
+        return nodeInx;
+    }
+
+    // splits by axis with biggest weighted spread
+    double biggestSpread = -1;
+    for (int axis = 0; axis < 4; axis++)
+    {
+        double minValue = INFINITY;
+        double maxValue = -INFINITY;
+        for (int i = begin; i < end; i++)
+        {
+            double value = getFeature(tree->flows[tree->order[i]], axis);
+            minValue = value < minValue ? value : minValue;
+            maxValue = value > maxValue ? value : maxValue;
+        }
+        double spread = sqrt(getWeight(tree->weights, axis))*(maxValue - minValue);
+        if (spread > biggestSpread)
+        {
+            biggestSpread = spread;
+            node->axis = axis;
+        }
+    }
+
+    // all flows are in the same point, so there is nothing to split
+    if (biggestSpread <= 0)
+    {
+        return nodeInx;
+    }
+
+    selectMiddleFlow(tree, begin, end, node->axis);
+    int middle = (begin + end)/2;
+    node->split = getFeature(tree->flows[tree->order[middle]], node->axis);
+
+    // node pointer can not be used after recursion, since it is only index in array
+    int left = buildKdNode(tree, begin, middle);
+    int right = buildKdNode(tree, middle, end);
+    tree->nodes[nodeInx].left = left;
+    tree->nodes[nodeInx].right = right;
+    return nodeInx;
+}
+
+// builds k-d tree over given flows
+int initKdTree(KdTree* tree, Flow* flows, int flowCount, Weights weights)
+{
+    tree->flows = flows;
+    tree->flowCount = flowCount;
+    tree->weights = weights;
+    tree->nodeCount = 0;
+    tree->order = malloc(sizeof(int)*flowCount);
+    // leaves have at least 4 flows, so there are at most flowCount/2 nodes
+    tree->nodes = malloc(sizeof(KdNode)*(flowCount/2 + 2));
+
+    // allocation check
+    if (tree->order == NULL || tree->nodes == NULL)
+    {
+        free(tree->order);
+        free(tree->nodes);
+        return 1;
+    }
+
+    for (int i = 0; i < flowCount; i++)
+    {
+        tree->order[i] = i;
+    }
+    buildKdNode(tree, 0, flowCount);
+    return 0;
+}
+
+void freeKdTree(KdTree* tree)
+{
+    free(tree->order);
+    free(tree->nodes);
+}
+
+// checks if neighbour a is farther than neighbour b (same ranges are ordered by flowID)
+bool isFartherNeighbour(KdTree* tree, Neighbour a, Neighbour b)
+{
+    if (a.range != b.range)
+    {
+        return a.range > b.range;
+    }
+    return tree->flows[a.flowInx].flowID > tree->flows[b.flowInx].flowID;
+}
+
+// offers candidate to list of found neighbours, which is kept as max-heap by range
+void offerNeighbour(KdTree* tree, Neighbour* found, int* foundCount, int k, Neighbour candidate)
+{
+    int i;
+    if (*foundCount < k)
+    {
+        // sifts new neighbour up
+        i = *foundCount;
+        (*foundCount)++;
+        while (i > 0 && isFartherNeighbour(tree, candidate, found[(i-1)/2]))
+        {
+            found[i] = found[(i-1)/2];
+            i = (i-1)/2;
+        }
+        found[i] = candidate;
+        return;
+    }
+
+    // candidate is not better than farthest found one
+    if (!isFartherNeighbour(tree, found[0], candidate))
+    {
+        return;
+    }
+
+    // replaces farthest neighbour and sifts candidate down
+    i = 0;
+    while (2*i + 1 < k)
+    {
+        int child = 2*i + 1;
+        if (child + 1 < k && isFartherNeighbour(tree, found[child+1], found[child]))
+        {
+            child++;
+        }
+        if (!isFartherNeighbour(tree, found[child], candidate))
+        {
+            break;
+        }
+        found[i] = found[child];
+        i = child;
+    }
+    found[i] = candidate;
+}
+
+// searches node for k nearest neighbours of query flow
+void searchKdNode(KdTree* tree, int nodeInx, int queryInx, Neighbour* found, int* foundCount, int k)
+{
+    KdNode node = tree->nodes[nodeInx];
+    Flow query = tree->flows[queryInx];
+
+    // leaf flows are compared directly
+    if (node.left == -1)
+    {
+        for (int i = node.begin; i < node.end; i++)
+        {
+            if (tree->order[i] == queryInx)
+            {
+                continue;
+            }
+            Neighbour candidate;
+            candidate.flowInx = tree->order[i];
+            candidate.range = findRange(query, tree->flows[candidate.flowInx], tree->weights);
+            offerNeighbour(tree, found, foundCount, k, candidate);
+        }
+        return;
+    }
+
+    // nearer side is searched first
+    double difference = getFeature(query, node.axis) - node.split;
+    int nearer = difference < 0 ? node.left : node.right;
+    int farther = difference < 0 ? node.right : node.left;
+    searchKdNode(tree, nearer, queryInx, found, foundCount, k);
+
+    // range to every flow on other side is at least weighted range to split plane
+    double planeRange = sqrt(getWeight(tree->weights, node.axis)*squareFloat(difference));
+    if (*foundCount < k || planeRange <= found[0].range)
+    {
+        searchKdNode(tree, farther, queryInx, found, foundCount, k);
+    }
+}
+
+// finds k nearest neighbours of flow and stores them sorted from nearest
+int findNearestNeighbours(KdTree* tree, int queryInx, int k, Neighbour* found)
+{
+    int foundCount = 0;
+    searchKdNode(tree, 0, queryInx, found, &foundCount, k);
+
+    // pops heap from its end, so the nearest neighbour ends up first
+    for (int last = foundCount - 1; last > 0; last--)
+    {
+        Neighbour farthest = found[0];
+        int heapCount = last;
+        Neighbour moved = found[last];
+        found[last] = farthest;
+
+        int i = 0;
+        while (2*i + 1 < heapCount)
+        {
+            int child = 2*i + 1;
+            if (child + 1 < heapCount && isFartherNeighbour(tree, found[child+1], found[child]))
+            {
+                child++;
+            }
+            if (!isFartherNeighbour(tree, found[child], moved))
+            {
+                break;
+            }
+            found[i] = found[child];
+            i = child;
+        }
+        found[i] = moved;
+    }
+    return foundCount;
+}
+
+// structure for sharing neighbour graph work between tasks
+typedef struct SNeighbourJob
+{
+    KdTree* tree;
+    int k;
+    Neighbour* results;
+}NeighbourJob;
+
+// finds neighbours of part of flows
+void findNeighboursOfPart(void* context, int begin, int end)
+{
+    NeighbourJob* job = context;
+
+    for (int i = begin; i < end; i++)
+    {
+        findNearestNeighbours(job->tree, i, job->k, &job->results[(size_t)i*job->k]);
+    }
+}
+
+// finds k nearest neighbours of all flows in parallel
+int findNeighbourGraph(KdTree* tree, int k, Neighbour* results)
+{
+    NeighbourJob job;
+    job.tree = tree;
+    job.k = k;
+    job.results = results;
+    parallelFor(tree->flowCount, 64, findNeighboursOfPart, &job);
+    return 0;
+}
+
+// prints found neighbours of flow
+void neighboursOut(KdTree* tree, int queryInx, Neighbour* found, int foundCount)
+{
+    printf("flow %i: ", tree->flows[queryInx].flowID);
+
+    for (int i = 0; i < foundCount; i++)
+    {
+        printf("%i:%g ", tree->flows[found[i].flowInx].flowID, found[i].range);
+    }
+    printf("\n");
+}
+
+// finds index of flow with given flowID in keys sorted by flowID, -1 if there is none
+int findFlowByID(FlowKey* byID, int flowCount, int flowID)
+{
+    int left = 0;
+    int right = flowCount - 1;
+    while (left <= right)
+    {
+        int middle = (left + right)/2;
+        int middleID = byID[middle].flowID;
+        if (middleID == flowID)
+        {
+            return byID[middle].flowInx;
+        }
+        if (middleID < flowID)
+        {
+            left = middle + 1;
+        }
+        else
+        {
+            right = middle - 1;
+        }
+    }
+    return -1;
+}
+
+// answers k nearest neighbours queries for flows given by flowIDs,
+// or for all flows if no flowIDs are given
+int answerNeighbourQueries(Flow* flows, int flowCount, int k, char* queryIDs[], int queryCount, Weights weights)
+{
+    KdTree tree;
+    if (initKdTree(&tree, flows, flowCount, weights) != 0)
+    {
+        fprintf(stderr, "ERROR alloc failed\n");
+        return 1;
+    }
+
+    // flows can not be their own neighbours
+    if (k > flowCount - 1)
+    {
+        k = flowCount - 1;
+    }
+
+    int resultCount = queryCount > 0 ? queryCount : flowCount;
+    Neighbour* results = malloc(sizeof(Neighbour)*((size_t)resultCount*k + 1));
+    int* queries = malloc(sizeof(int)*resultCount);
+    FlowKey* byID = malloc(sizeof(FlowKey)*flowCount);
+    FlowKey* tmpKeys = malloc(sizeof(FlowKey)*flowCount);
+
+    // allocation check
+    if (results == NULL || queries == NULL || byID == NULL || tmpKeys == NULL)
+    {
+        fprintf(stderr, "ERROR alloc failed\n");
+        free(results);
+        free(queries);
+        free(byID);
+        free(tmpKeys);
+        freeKdTree(&tree);
+        return 1;
+    }
+
+    // flow keys sorted by flowID are used for looking up queried flows
+    for (int i = 0; i < flowCount; i++)
+    {
+        byID[i].flowID = flows[i].flowID;
+        byID[i].flowInx = i;
+    }
+    radixSortKeys(byID, tmpKeys, flowCount);
+    free(tmpKeys);
+
+    int result = 0;
+    if (queryCount > 0)
+    {
+        // queries are answered one by one
+        for (int i = 0; i < queryCount && result == 0; i++)
+        {
+            // flowIDs out of int range can not be in file, so they are not cast to it
+            char* endptr;
+            errno = 0;
+            long flowID = strtol(queryIDs[i], &endptr, 10);
+            bool isValidID = endptr != queryIDs[i] && *endptr == '\0' && errno != ERANGE && flowID >= 0 && flowID <= INT_MAX;
+            queries[i] = isValidID ? findFlowByID(byID, flowCount, (int)flowID) : -1;
+            if (queries[i] == -1)
+            {
+                fprintf(stderr, "ERROR: Flow %s was not found\n", queryIDs[i]);
+                result = 1;
+                break;
+            }
+            findNearestNeighbours(&tree, queries[i], k, &results[(size_t)i*k]);
+        }
+    }
+    else
+    {
+        // whole graph is found in parallel
+        for (int i = 0; i < flowCount; i++)
+        {
+            queries[i] = i;
+        }
+        result = findNeighbourGraph(&tree, k, results);
+    }
+
+    if (result == 0)
+    {
+        printf("Neighbours:\n");
+        for (int i = 0; i < resultCount; i++)
+        {
+            neighboursOut(&tree, queries[i], &results[(size_t)i*k], k);
+        }
+    }
+
+    free(results);
+    free(queries);
+    free(byID);
+    freeKdTree(&tree);
+    return result;
+}
+
+// runs "knn FILENAME K [FLOWID...]" mode
+int runNeighboursMode(int argc, char* argv[], Options options)
+{
+    char* endptr;
+
+    // neighbours are not clusters, so there is nothing to export
+    if (argc < 4 || options.exportPath != NULL)
+    {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        return 1;
+    }
+    long k = strtol(argv[3], &endptr, 10);
+    if (*endptr != '\0' || k <= 0 || k > INT32_MAX)
+    {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        return 1;
+    }
+
+    ClusterStorage storage;
+    if (loadStorageFromFile(argv[2], &storage, NULL) != 0)
+    {
+        return 1;
+    }
+
+    // copies single flows of clusters to one continuous array
+    Flow* flows = malloc(sizeof(Flow)*(storage.clusterCount + 1));
+    if (flows == NULL)
+    {
+        finishProgram(afterRead, 1, 0, &storage, 0);
+        return 1;
+    }
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        flows[i] = storage.clusters[i].flows[0];
+    }
+
+    int result = 0;
+    if (storage.clusterCount > 1)
+    {
+        result = answerNeighbourQueries(flows, storage.clusterCount, (int)k, &argv[4], argc - 4, options.weights);
+    }
+
+    // errors were already reported
+    free(flows);
+    finishProgram(afterRead, 0, 0, &storage, 0);
+    return result;
+}
+
+// Functions for clustering flows in sliding window
+// -------------------------------------------------------------------------------------
+
+// returns index of flow in window's parent array
+int windowInx(WindowTree* tree, int flowInx)
+{
+    return flowInx - tree->begin;
+}
+
+void freeWindowTree(WindowTree* tree)
+{
+    free(tree->edges);
+    free(tree->tmpEdges);
+    free(tree->parent);
+    free(tree->partSize);
+}
+
+// inits empty window tree over given flows
+int initWindowTree(WindowTree* tree, Flow* flows, int windowSize, Weights weights)
+{
+    tree->flows = flows;
+    tree->weights = weights;
+    tree->begin = 0;
+    tree->end = 0;
+    tree->edgeCount = 0;
+    tree->edges = malloc(sizeof(Edge)*(windowSize + 1));
+    tree->tmpEdges = malloc(sizeof(Edge)*2*(windowSize + 1));
+    tree->parent = malloc(sizeof(int)*(windowSize + 1));
+    tree->partSize = malloc(sizeof(int)*(windowSize + 1));
+
+    // allocation check
+    if (tree->edges == NULL || tree->tmpEdges == NULL || tree->parent == NULL || tree->partSize == NULL)
+    {
+        freeWindowTree(tree);
+        return 1;
+    }
+    return 0;
+}
+
+// adds flow at the end of window, new tree is built by Kruskal's algorithm
+// only from old tree edges and edges from new flow (both sorted), so it needs O(n log n)
+void insertIntoWindowTree(WindowTree* tree)
+{
+    int added = tree->end;
+    int starCount = added - tree->begin;
+    Edge* star = &tree->tmpEdges[tree->edgeCount];
+
+    // edges from new flow to all flows in window
+    for (int i = tree->begin; i < added; i++)
+    {
+        star[i - tree->begin] = initEdge(i, added, findRange(tree->flows[i], tree->flows[added], tree->weights));
+    }
+    sortEdges(star, starCount);
+
+    tree->end++;
+    for (int i = tree->begin; i < tree->end; i++)
+    {
+        tree->parent[windowInx(tree, i)] = windowInx(tree, i);
+    }
+
+    // old edges are moved to tmp array, so merged result can be written to edges
+    memcpy(tree->tmpEdges, tree->edges, sizeof(Edge)*tree->edgeCount);
+    Edge* oldEdges = tree->tmpEdges;
+    int oldInx = 0;
+    int starInx = 0;
+    int oldCount = tree->edgeCount;
+    tree->edgeCount = 0;
+
+    while (oldInx < oldCount || starInx < starCount)
+    {
+        Edge edge;
+        if (starInx >= starCount || (oldInx < oldCount && isShorterEdge(oldEdges[oldInx], star[starInx])))
+        {
+            edge = oldEdges[oldInx];
+            oldInx++;
+        }
+        else
+        {
+            edge = star[starInx];
+            starInx++;
+        }
+
+        int rootA = findRoot(tree->parent, windowInx(tree, edge.clusterA));
+        int rootB = findRoot(tree->parent, windowInx(tree, edge.clusterB));
+        if (rootA != rootB)
+        {
+            tree->parent[rootA] = rootB;
+            tree->edges[tree->edgeCount] = edge;
+            tree->edgeCount++;
+        }
+    }
+}
+
+// removes first flow of window, tree edges which did not touch it stay in tree,
+// parts of tree are then reconnected by their shortest edges (Boruvka's algorithm),
+// the biggest part is never searched, so removing leaves costs almost nothing
+void removeFromWindowTree(WindowTree* tree)
+{
+    int removed = tree->begin;
+
+    // removes edges of removed flow
+    int keptCount = 0;
+    for (int i = 0; i < tree->edgeCount; i++)
+    {
+        if (tree->edges[i].clusterA != removed && tree->edges[i].clusterB != removed)
+        {
+            tree->edges[keptCount] = tree->edges[i];
+            keptCount++;
+        }
+    }
+    int removedCount = tree->edgeCount - keptCount;
+    tree->edgeCount = keptCount;
+    tree->begin++;
+
+    if (removedCount <= 1)
+    {
+        return;
+    }
+
+    // finds parts of tree
+    int* parent = tree->parent;
+    for (int i = tree->begin; i < tree->end; i++)
+    {
+        parent[windowInx(tree, i)] = windowInx(tree, i);
+    }
+    for (int i = 0; i < tree->edgeCount; i++)
+    {
+        parent[findRoot(parent, windowInx(tree, tree->edges[i].clusterA))] =
+            findRoot(parent, windowInx(tree, tree->edges[i].clusterB));
+    }
+
+    // every part except the biggest finds its shortest edge to other part,
+    // tmpEdges store shortest edge for every root
+    Edge* shortest = tree->tmpEdges;
+    int* sizes = tree->partSize;
+    int partCount = removedCount;
+    while (partCount > 1)
+    {
+        int biggestRoot = -1;
+        for (int i = tree->begin; i < tree->end; i++)
+        {
+            sizes[windowInx(tree, i)] = 0;
+            shortest[windowInx(tree, i)] = initEdge(i, i, INFINITY);
+        }
+        for (int i = tree->begin; i < tree->end; i++)
+        {
+            int root = findRoot(parent, windowInx(tree, i));
+            sizes[root]++;
+            if (biggestRoot == -1 || sizes[root] > sizes[biggestRoot])
+            {
+                biggestRoot = root;
+            }
+        }
+
+        for (int i = tree->begin; i < tree->end; i++)
+        {
+            int root = findRoot(parent, windowInx(tree, i));
+            if (root == biggestRoot)
+            {
+                continue;
+            }
+            for (int n = tree->begin; n < tree->end; n++)
+            {
+                if (findRoot(parent, windowInx(tree, n)) == root)
+                {
+                    continue;
+                }
+                Edge edge = initEdge(i, n, findRange(tree->flows[i], tree->flows[n], tree->weights));
+                if (isMissingEdge(shortest[root]) || isShorterEdge(edge, shortest[root]))
+                {
+                    shortest[root] = edge;
+                }
+            }
+        }
+
+        // adds found edges, same edge can be found by both its parts
+        int foundCount = partCount;
+        for (int i = tree->begin; i < tree->end; i++)
+        {
+            int inx = windowInx(tree, i);
+            if (isMissingEdge(shortest[inx]) || findRoot(parent, inx) != inx)
+            {
+                continue;
+            }
+            Edge edge = shortest[inx];
+            int rootA = findRoot(parent, windowInx(tree, edge.clusterA));
+            int rootB = findRoot(parent, windowInx(tree, edge.clusterB));
+            if (rootA != rootB)
+            {
+                parent[rootA] = rootB;
+                tree->edges[tree->edgeCount] = edge;
+                tree->edgeCount++;
+                partCount--;
+            }
+        }
+
+        // if no edge was found, remaining parts are linked by infinite edges
+        if (partCount == foundCount)
+        {
+            for (int i = tree->begin + 1; i < tree->end; i++)
+            {
+                int rootA = findRoot(parent, windowInx(tree, tree->begin));
+                int rootB = findRoot(parent, windowInx(tree, i));
+                if (rootA != rootB)
+                {
+                    parent[rootA] = rootB;
+                    tree->edges[tree->edgeCount] = initEdge(tree->begin, i, INFINITY);
+                    tree->edgeCount++;
+                    partCount--;
+                }
+            }
+        }
+    }
+
+    // keeps edges sorted for next insertion
+    sortEdges(tree->edges, tree->edgeCount);
+}
+
+// unites flows of window along its tree and prints resulting clusters to given output
+int windowOut(FILE* out, WindowTree* tree, int destClusterCount, Options options, int windowNumber)
+{
+    int count = tree->end - tree->begin;
+    ClusterStorage storage;
+    storage.clusterCount = 0;
+    storage.clusters = malloc(sizeof(Cluster)*count);
+
+    // allocation check
+    if (storage.clusters == NULL)
+    {
+        return 1;
+    }
+
+    // every flow of window starts in its own cluster
+    for (int i = 0; i < count; i++)
+    {
+        storage.clusters[i] = initCluster(&tree->flows[tree->begin + i], 1);
+        if (storage.clusters[i].flowCount == -1)
+        {
+            finishProgram(afterRead, 1, 0, &storage, 0);
+            return 1;
+        }
+        storage.clusterCount++;
+    }
+
+    // edges are copied with indexes of clusters in storage, since cut sorts them
+    for (int i = 0; i < tree->edgeCount; i++)
+    {
+        tree->tmpEdges[i] = initEdge(windowInx(tree, tree->edges[i].clusterA),
+            windowInx(tree, tree->edges[i].clusterB), tree->edges[i].range);
+    }
+
+    // without wanted count flows of window are only sorted, as in other modes
+    if (count > 1 && destClusterCount != -1 &&
+        cutSpanningTree(&storage, tree->tmpEdges, destClusterCount, options.maxDistance) != 0)
+    {
+        finishProgram(afterRead, 1, 0, &storage, 0);
+        return 1;
+    }
+    sortClustersByID(storage.clusters, storage.clusterCount);
+
+    fprintf(out, "Window %i (flows %i-%i):\n", windowNumber, tree->begin, tree->end - 1);
+    resultOut(out, storage, options);
+
+    finishProgram(afterRead, 0, 0, &storage, 0);
+    return 0;
+}
+
+// clusters every window of flows in storage and prints them to given output, tree is updated
+// only by flows which entered or left window instead of rebuilding it for every step
+int uniteInWindows(FILE* out, int destClusterCount, ClusterStorage* storage, Weights weights, Options options)
+{
+    int flowCount = storage->clusterCount;
+    Flow* flows = malloc(sizeof(Flow)*(flowCount + 1));
+    WindowTree tree;
+
+    // allocation check
+    if (flows == NULL || initWindowTree(&tree, flows, options.windowSize, weights) != 0)
+    {
+        free(flows);
+        return 1;
+    }
+
+    // flows are kept in order in which they were read
+    for (int i = 0; i < flowCount; i++)
+    {
+        flows[i] = storage->clusters[i].flows[0];
+    }
+
+    int windowNumber = 0;
+    int result = 0;
+    while (result == 0)
+    {
+        // slides window by step, first window is just filled,
+        // oldest flow leaves before new one enters, so window never grows over its size
+        int windowEnd = windowNumber*options.windowStep + options.windowSize;
+        while (tree.end < windowEnd && tree.end < flowCount)
+        {
+            if (tree.end - tree.begin == options.windowSize)
+            {
+                removeFromWindowTree(&tree);
+            }
+            insertIntoWindowTree(&tree);
+        }
+
+        result = windowOut(out, &tree, destClusterCount, options, windowNumber);
+        if (tree.end == flowCount)
+        {
+            break;
+        }
+        windowNumber++;
+    }
+
+    freeWindowTree(&tree);
+    free(flows);
+    return result;
+}
+
+// Functions for clustering flows separately in partitions by their addresses
+// -------------------------------------------------------------------------------------
+
+// keeps first prefixLength bits of address
+uint32_t maskAddress(uint32_t address, int prefixLength)
+{
+    return prefixLength == 0 ? 0 : address & (0xffffffffu << (32 - prefixLength));
+}
+
+// finds key of partition to which flow belongs, its addresses are found by its input index
+uint64_t partitionKey(Flow flow, const uint32_t* addresses, Options options)
+{
+    uint32_t src = maskAddress(addresses[2*flow.inputInx], options.partitionPrefix);
+    uint32_t dst = maskAddress(addresses[2*flow.inputInx + 1], options.partitionPrefix);
+
+    switch (options.partitionBy)
+    {
+        case sourcePartition:
+            return src;
+        case destinationPartition:
+            return dst;
+        default:
+            return ((uint64_t)src << 32) | dst;
+    }
+}
+
+void freePartitions(Partition* partitions, int partitionCount)
+{
+    for (int p = 0; p < partitionCount; p++)
+    {
+        finishProgram(afterRead, 0, 0, &partitions[p].storage, 1);
+    }
+    free(partitions);
+}
+
+// moves clusters from storage to partitions found using hash index of their keys,
+// partitions are ordered by their keys
+int splitToPartitions(ClusterStorage* storage, const uint32_t* addresses, Options options,
+    Partition** partitionsOut, int* partitionCountOut)
+{
+    int count = storage->clusterCount;
+
+    // table size is power of 2 which is at least twice bigger than cluster count
+    size_t tableSize = 1;
+    while (tableSize < 2*(size_t)count)
+    {
+        tableSize <<= 1;
+    }
+
+    int* table = malloc(sizeof(int)*tableSize);
+    int* partitionOf = malloc(sizeof(int)*count);
+    Partition* partitions = malloc(sizeof(Partition)*count);
+
+    // allocation check
+    if (table == NULL || partitionOf == NULL || partitions == NULL)
+    {
+        free(table);
+        free(partitionOf);
+        free(partitions);
+        return 1;
+    }
+
+    // -1 marks empty slot, other values are partition indexes
+    for (size_t i = 0; i < tableSize; i++)
+    {
+        table[i] = -1;
+    }
+
+    // finds partition of every cluster, cluster count of partition is counted in its storage
+    int partitionCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t key = partitionKey(storage->clusters[i].flows[0], addresses, options);
+        size_t slot = mixBits(key) & (tableSize - 1);
+
+        while (table[slot] != -1 && partitions[table[slot]].key != key)
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        // opens new partition if key was not seen yet
+        if (table[slot] == -1)
+        {
+            table[slot] = partitionCount;
+            partitions[partitionCount].key = key;
+            partitions[partitionCount].storage.clusterCount = 0;
+            partitions[partitionCount].result = 0;
+            partitionCount++;
+        }
+        partitionOf[i] = table[slot];
+        partitions[table[slot]].storage.clusterCount++;
+    }
+    free(table);
+
+    // allocates cluster arrays of partitions
+    bool isAllocated = true;
+    for (int p = 0; p < partitionCount; p++)
+    {
+        partitions[p].storage.clusters = malloc(sizeof(Cluster)*partitions[p].storage.clusterCount);
+        isAllocated = isAllocated && partitions[p].storage.clusters != NULL;
+        partitions[p].storage.clusterCount = 0;
+    }
+    if (!isAllocated)
+    {
+        freePartitions(partitions, partitionCount);
+        free(partitionOf);
+        return 1;
+    }
+
+    // moves clusters to their partitions, so storage is left empty
+    for (int i = 0; i < count; i++)
+    {
+        ClusterStorage* partition = &partitions[partitionOf[i]].storage;
+        partition->clusters[partition->clusterCount] = storage->clusters[i];
+        partition->clusterCount++;
+    }
+    free(storage->clusters);
+    storage->clusters = NULL;
+    storage->clusterCount = 0;
+    free(partitionOf);
+
+    // orders partitions by their keys, so output does not depend on order of flows
+    qsort(partitions, partitionCount, sizeof(Partition), comparePartitions);
+
+    *partitionsOut = partitions;
+    *partitionCountOut = partitionCount;
+    return 0;
+}
+
+// clusters part of partitions, parts are taken from biggest partition
+void clusterPartitions(void* context, int begin, int end)
+{
+    PartitionJob* job = context;
+
+    for (int orderInx = begin; orderInx < end; orderInx++)
+    {
+        Partition* partition = &job->partitions[job->order[orderInx]];
+
+        // partitions smaller than wanted count are left as they are
+        int destClusterCount = job->destClusterCount;
+        if (destClusterCount > partition->storage.clusterCount)
+        {
+            destClusterCount = partition->storage.clusterCount;
+        }
+        partition->result = clusterToNGroups(destClusterCount, &partition->storage, job->weights, job->options);
+    }
+}
+
+// prints address with prefix length
+void addressOut(FILE* out, uint32_t address, int prefixLength)
+{
+    fprintf(out, "%u.%u.%u.%u/%i", address >> 24, (address >> 16) & 0xff,
+        (address >> 8) & 0xff, address & 0xff, prefixLength);
+}
+
+// prints info about clusters of partition
+void partitionOut(FILE* out, Partition partition, Options options)
+{
+    fprintf(out, "Partition ");
+    if (options.partitionBy == pairPartition)
+    {
+        addressOut(out, (uint32_t)(partition.key >> 32), options.partitionPrefix);
+        fprintf(out, " -> ");
+    }
+    addressOut(out, (uint32_t)partition.key, options.partitionPrefix);
+    fprintf(out, ":\n");
+    resultOut(out, partition.storage, options);
+}
+
+// splits flows to partitions by their addresses and clusters every partition independently
+// in parallel, so one big problem is replaced by many small ones, prints them to given output
+int uniteInPartitions(FILE* out, int destClusterCount, ClusterStorage* storage, const uint32_t* addresses,
+    Weights weights, Options options)
+{
+    PartitionJob job;
+    if (splitToPartitions(storage, addresses, options, &job.partitions, &job.partitionCount) != 0)
+    {
+        return 1;
+    }
+
+    job.order = malloc(sizeof(int)*job.partitionCount);
+    FlowKey* bySize = malloc(sizeof(FlowKey)*job.partitionCount);
+    FlowKey* tmpKeys = malloc(sizeof(FlowKey)*job.partitionCount);
+
+    // allocation check
+    if (job.order == NULL || bySize == NULL || tmpKeys == NULL)
+    {
+        free(job.order);
+        free(bySize);
+        free(tmpKeys);
+        freePartitions(job.partitions, job.partitionCount);
+        return 1;
+    }
+
+    // biggest partitions are started first (negative size is used as key)
+    for (int p = 0; p < job.partitionCount; p++)
+    {
+        bySize[p].flowID = -job.partitions[p].storage.clusterCount;
+        bySize[p].flowInx = p;
+    }
+    radixSortKeys(bySize, tmpKeys, job.partitionCount);
+    for (int p = 0; p < job.partitionCount; p++)
+    {
+        job.order[p] = bySize[p].flowInx;
+    }
+    free(bySize);
+    free(tmpKeys);
+
+    job.destClusterCount = destClusterCount;
+    job.weights = weights;
+    job.options = options;
+
+    // every partition is separate task, big ones can use nested parallel parts too
+    parallelFor(job.partitionCount, 1, clusterPartitions, &job);
+
+    int result = 0;
+    for (int p = 0; p < job.partitionCount; p++)
+    {
+        result |= job.partitions[p].result;
+    }
+    if (result == 0)
+    {
+        for (int p = 0; p < job.partitionCount; p++)
+        {
+            partitionOut(out, job.partitions[p], options);
+        }
+    }
+
+    free(job.order);
+    freePartitions(job.partitions, job.partitionCount);
+    return result;
+}
+
+// Functions for clustering many files in one run
+// -------------------------------------------------------------------------------------
+
+// reads whole file to memory with pread, returns NULL if it failed
+char* readWholeFile(const char* fileName, size_t* size)
+{
+    int fd = open(fileName, O_RDONLY);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+
+    struct stat fileInfo;
+    if (fstat(fd, &fileInfo) != 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    // one more byte, so even empty file gets its buffer
+    char* data = malloc(fileInfo.st_size + 1);
+    if (data == NULL)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    size_t readSize = 0;
+    while (readSize < (size_t)fileInfo.st_size)
+    {
+        ssize_t n = pread(fd, data + readSize, fileInfo.st_size - readSize, readSize);
+        if (n <= 0)
+        {
+            free(data);
+            close(fd);
+            return NULL;
+        }
+        readSize += n;
+    }
+    close(fd);
+
+    *size = readSize;
+    return data;
+}
+
+// loads source files of jobs ahead of clustering threads
+void* batchReader(void* arg)
+{
+    Batch* batch = arg;
+
+    while (true)
+    {
+        // waits until there is place for another loaded file
+        pthread_mutex_lock(&batch->lock);
+        while (batch->nextToLoad < batch->jobCount && batch->loadedCount >= batch->maxLoadedCount)
+        {
+            pthread_cond_wait(&batch->changed, &batch->lock);
+        }
+        if (batch->nextToLoad >= batch->jobCount)
+        {
+            pthread_mutex_unlock(&batch->lock);
+            return NULL;
+        }
+        BatchJob* job = &batch->jobs[batch->nextToLoad];
+        batch->nextToLoad++;
+        batch->loadedCount++;
+        pthread_mutex_unlock(&batch->lock);
+
+        char* data = readWholeFile(job->fileName, &job->size);
+
+        pthread_mutex_lock(&batch->lock);
+        job->data = data;
+        job->state = data == NULL ? jobFailed : jobLoaded;
+        pthread_cond_broadcast(&batch->changed);
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+// parses loaded file of job and clusters its flows to storage
+int clusterLoadedJob(BatchJob* job, Options options, ClusterStorage* storage)
+{
+    // loaded file is parsed by same function as files opened from disk
+    FILE* srcFile = fmemopen(job->data, job->size, "r");
+    if (srcFile == NULL)
+    {
+        finishProgram(fileOpen, 1, 0, 0, 0);
+        return 1;
+    }
+
+    if (collectInfoFromSourceFile(srcFile, storage, NULL) == 1)
+    {
+        return 1;
+    }
+    if (storage->clusterCount == -1)
+    {
+        finishProgram(afterRead, 1, 0, storage, 0);
+        return 1;
+    }
+
+    if (clusterToNGroups(job->destClusterCount, storage, job->weights, options) != 0)
+    {
+        finishProgram(afterRead, 1, 0, storage, 1);
+        return 1;
+    }
+    return 0;
+}
+
+// clusters loaded file of job and writes result to its output file
+int runBatchJob(BatchJob* job, Options options)
+{
+    if (job->state == jobFailed)
+    {
+        finishProgram(fileOpen, 1, 0, 0, 0);
+        return 1;
+    }
+
+    ClusterStorage storage;
+    if (clusterLoadedJob(job, options, &storage) != 0)
+    {
+        return 1;
+    }
+
+    FILE* out = fopen(job->outName, "w");
+    if (out == NULL)
+    {
+        finishProgram(fileOpen, 1, 0, 0, 0);
+        finishProgram(afterRead, 0, 0, &storage, 1);
+        return 1;
+    }
+    resultOut(out, storage, options);
+    int result = fclose(out) == 0 ? 0 : 1;
+
+    finishProgram(afterRead, 0, 0, &storage, 1);
+    return result;
+}
+
+// takes jobs in manifest order and clusters them once their files are loaded
+void* batchWorker(void* arg)
+{
+    Batch* batch = arg;
+
+    while (true)
+    {
+        pthread_mutex_lock(&batch->lock);
+        if (batch->nextToRun >= batch->jobCount)
+        {
+            pthread_mutex_unlock(&batch->lock);
+            return NULL;
+        }
+        BatchJob* job = &batch->jobs[batch->nextToRun];
+        batch->nextToRun++;
+        while (job->state == jobWaiting)
+        {
+            pthread_cond_wait(&batch->changed, &batch->lock);
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        job->result = runBatchJob(job, batch->options);
+        if (job->result != 0)
+        {
+            fprintf(stderr, "ERROR: Job with file %s failed\n", job->fileName);
+        }
+
+        // frees loaded file, so reader can load next one
+        pthread_mutex_lock(&batch->lock);
+        free(job->data);
+        job->data = NULL;
+        batch->loadedCount--;
+        pthread_cond_broadcast(&batch->changed);
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+// runs batch worker for every part of loop
+void runBatchWorkers(void* context, int begin, int end)
+{
+    for (int i = begin; i < end; i++)
+    {
+        batchWorker(context);
+    }
+}
+
+void freeBatchJobs(BatchJob* jobs, int jobCount)
+{
+    for (int i = 0; i < jobCount; i++)
+    {
+        free(jobs[i].fileName);
+        free(jobs[i].outName);
+    }
+    free(jobs);
+}
+
+// reads jobs from manifest, every line is "FILENAME [N WB WT WD WS] [OUTFILE]",
+// empty lines and lines starting with # are skipped
+int collectJobsFromManifest(FILE* manifest, BatchJob** jobsOut, int* jobCountOut)
+{
+    BatchJob* jobs = NULL;
+    int jobCount = 0;
+    char line[4096];
+
+    while (fgets(line, sizeof(line), manifest) != NULL)
+    {
+        // splits line to arguments same as on command line (first one is mode name)
+        char* args[9];
+        int argCount = 1;
+        args[0] = "batch";
+        for (char* token = strtok(line, " \t\r\n"); token != NULL; token = strtok(NULL, " \t\r\n"))
+        {
+            if (argCount == 9)
+            {
+                argCount++;
+                break;
+            }
+            args[argCount] = token;
+            argCount++;
+        }
+        if (argCount == 1 || args[1][0] == '#')
+        {
+            continue;
+        }
+
+        // output file name is optional last argument
+        char* outName = NULL;
+        if (argCount == 3 || argCount == 8)
+        {
+            argCount--;
+            outName = args[argCount];
+        }
+
+        BatchJob job;
+        if ((argCount != 2 && argCount != 7) ||
+            collectInfoFromInput(argCount, args, &job.weights, &job.destClusterCount) != 0)
+        {
+            freeBatchJobs(jobs, jobCount);
+            return 1;
+        }
+
+        // results are written next to source file if output is not given
+        job.fileName = strdup(args[1]);
+        job.outName = malloc(strlen(args[1]) + 5);
+        if (job.outName != NULL)
+        {
+            strcpy(job.outName, args[1]);
+            strcat(job.outName, ".out");
+        }
+        if (outName != NULL)
+        {
+            free(job.outName);
+            job.outName = strdup(outName);
+        }
+        job.data = NULL;
+        job.size = 0;
+        job.state = jobWaiting;
+        job.result = 0;
+
+        BatchJob* tmp = realloc(jobs, sizeof(BatchJob)*(jobCount + 1));
+        if (tmp == NULL || job.fileName == NULL || job.outName == NULL)
+        {
+            free(job.fileName);
+            free(job.outName);
+            freeBatchJobs(tmp == NULL ? jobs : tmp, jobCount);
+            return 1;
+        }
+        jobs = tmp;
+        jobs[jobCount] = job;
+        jobCount++;
+    }
+
+    *jobsOut = jobs;
+    *jobCountOut = jobCount;
+    return 0;
+}
+
+// runs "batch MANIFEST" mode, files are read by reader threads while
+// worker threads cluster already loaded ones
+int runBatchMode(int argc, char* argv[], Options options)
+{
+    // jobs write only text results, one export can not hold all of them,
+    // and every job is clustered as a whole file with weights from manifest
+    if (argc != 3 || options.exportPath != NULL || options.windowSize > 0 || options.partitionBy != noPartition ||
+        options.approxEps > 0 || options.weightsFile != NULL)
+    {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        return 1;
+    }
+
+    FILE* manifest = fopen(argv[2], "r");
+    if (manifest == NULL)
+    {
+        finishProgram(fileOpen, 1, 0, 0, 0);
+        return 1;
+    }
+
+    Batch batch;
+    if (collectJobsFromManifest(manifest, &batch.jobs, &batch.jobCount) != 0)
+    {
+        fclose(manifest);
+        fprintf(stderr, "ERROR: Something is wrong with manifest\n");
+        return 1;
+    }
+    fclose(manifest);
+
+    int workerCount = taskScheduler.threadCount > 1 ? taskScheduler.threadCount : 1;
+    const int readerCount = 2;
+
+    batch.options = options;
+    batch.nextToLoad = 0;
+    batch.nextToRun = 0;
+    batch.loadedCount = 0;
+    batch.maxLoadedCount = 2*workerCount;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.changed, NULL);
+
+    // readers have to run on their own threads, otherwise workers would wait forever
+    pthread_t readers[readerCount];
+    int startedReaders = 0;
+    for (int i = 0; i < readerCount; i++)
+    {
+        if (pthread_create(&readers[startedReaders], NULL, batchReader, &batch) == 0)
+        {
+            startedReaders++;
+        }
+    }
+    if (startedReaders == 0)
+    {
+        batchReader(&batch);
+    }
+
+    // every worker of pool takes jobs until none are left
+    parallelFor(workerCount, 1, runBatchWorkers, &batch);
+
+    for (int i = 0; i < startedReaders; i++)
+    {
+        pthread_join(readers[i], NULL);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.changed);
+
+    // prints where every job's result was written
+    int result = 0;
+    printf("Jobs:\n");
+    for (int i = 0; i < batch.jobCount; i++)
+    {
+        printf("job %i: %s -> %s %s\n", i, batch.jobs[i].fileName, batch.jobs[i].outName,
+            batch.jobs[i].result == 0 ? "done" : "failed");
+        result |= batch.jobs[i].result;
+    }
+
+    freeBatchJobs(batch.jobs, batch.jobCount);
+    return result;
+}
+
+// Functions for exporting result in binary form
+// -------------------------------------------------------------------------------------
+
+// writes clusters and recorded merges to mapped file or shared memory object with layout
+// described in flows_export.h, so other programs can use them without parsing
+int exportResult(const char* path, ClusterStorage storage)
+{
+    int flowCount = 0;
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        flowCount += storage.clusters[i].flowCount;
+    }
+    int mergeCount = mergeLog.merges != NULL ? mergeLog.mergeCount : 0;
+
+    FlowsExportHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, FLOWS_EXPORT_MAGIC, 8);
+    header.version = FLOWS_EXPORT_VERSION;
+    header.headerSize = sizeof(FlowsExportHeader);
+    header.flowCount = flowCount;
+    header.clusterCount = storage.clusterCount;
+    header.mergeCount = mergeCount;
+    header.assignmentOffset = flowsExportNextOffset(0, sizeof(FlowsExportHeader));
+    header.clusterStartsOffset = flowsExportNextOffset(header.assignmentOffset, sizeof(int32_t)*(uint64_t)flowCount);
+    header.memberIDsOffset = flowsExportNextOffset(header.clusterStartsOffset,
+        sizeof(int32_t)*((uint64_t)storage.clusterCount + 1));
+    header.memberInputsOffset = flowsExportNextOffset(header.memberIDsOffset, sizeof(int32_t)*(uint64_t)flowCount);
+    header.mergesOffset = flowsExportNextOffset(header.memberInputsOffset, sizeof(int32_t)*(uint64_t)flowCount);
+    header.totalSize = flowsExportNextOffset(header.mergesOffset, sizeof(FlowsExportMerge)*(uint64_t)mergeCount);
+
+    int fd = flowsExportOpenPath(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        return 1;
+    }
+    if (ftruncate(fd, (off_t)header.totalSize) != 0)
+    {
+        close(fd);
+        return 1;
+    }
+    char* data = mmap(NULL, header.totalSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    int32_t* assignment = (int32_t*)(data + header.assignmentOffset);
+    int32_t* clusterStarts = (int32_t*)(data + header.clusterStartsOffset);
+    int32_t* memberIDs = (int32_t*)(data + header.memberIDsOffset);
+    int32_t* memberInputs = (int32_t*)(data + header.memberInputsOffset);
+
+    // flows of clusters are already sorted by flowID
+    int member = 0;
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        clusterStarts[i] = member;
+        for (int n = 0; n < storage.clusters[i].flowCount; n++)
+        {
+            Flow flow = storage.clusters[i].flows[n];
+            memberIDs[member] = flow.flowID;
+            memberInputs[member] = flow.inputInx;
+            assignment[flow.inputInx] = i;
+            member++;
+        }
+    }
+    clusterStarts[storage.clusterCount] = member;
+    if (mergeCount > 0)
+    {
+        memcpy(data + header.mergesOffset, mergeLog.merges, sizeof(FlowsExportMerge)*mergeCount);
+    }
+
+    // header is written last, so readers of shared memory never see incomplete result as valid one
+    memcpy(data, &header, sizeof(header));
+    int result = msync(data, header.totalSize, MS_SYNC) != 0;
+    munmap(data, header.totalSize);
+    return result;
+}
+
+// Functions for verifying engines against reference engine
+// -------------------------------------------------------------------------------------
+
+// kinds of generated inputs
+enum verifyInputKind
+{
+    randomInput,
+    tiedInput,
+    zeroWeightInput,
+    duplicateInput,
+    extremeInput,
+    overflowInput,
+    verifyInputKindCount
+};
+
+// kinds of variants, engine variants are compared by clusters of flows,
+// modes which print more results are compared by their whole output
+enum verifyVariantKind
+{
+    engineVariant,
+    maxDistanceVariant,
+    batchVariant,
+    weightsFileVariant,
+    windowVariant,
+    partitionVariant
+};
+
+// one way of clustering which is compared with reference
+typedef struct SVerifyVariant
+{
+    const char* name;
+    int kind;
+    Options options;
+    int threadCount;
+    int mismatchCount;
+    int tieCount;
+    double seconds;
+    // time of reference doing the same work
+    double referenceSeconds;
+}VerifyVariant;
+
+// one generated input with everything which is needed for comparing variants on it
+typedef struct SVerifyCase
+{
+    Flow* flows;
+    // packet counts and addresses are not kept in flows, but input files need them
+    int* packets;
+    uint32_t* addresses;
+    int count;
+    int destClusterCount;
+    Weights weights;
+    // range of random edge of tree, it is used as limit of max distance variants
+    double maxDistance;
+    // weight vectors of weights file variant, the first one is weights of case
+    Weights sweepWeights[3];
+    int windowSize;
+    int windowStep;
+    // edges of spanning tree sorted by compareEdges
+    Edge* edges;
+    // cluster of every flow by reference, without and with max distance
+    int* expected;
+    int* expectedFar;
+    int* got;
+    // tmp arrays for validation and partitions
+    int* roots;
+    int* firstOf;
+    int* queue;
+    Flow* partFlows;
+}VerifyCase;
+
+// returns next pseudo-random number of generator
+uint64_t nextRandom(uint64_t* state)
+{
+    *state += 0x9e3779b97f4a7c15ULL;
+    return mixBits(*state);
+}
+
+// returns pseudo-random number from 0 to bound-1
+int randomBelow(uint64_t* state, int bound)
+{
+    return (int)(nextRandom(state) % (uint64_t)bound);
+}
+
+// generates flows of given kind with their packet counts and addresses,
+// flowIDs are shuffled, so input order is not sorted
+void generateFlows(Flow* flows, int* packets, uint32_t* addresses, int count, int kind, uint64_t* state,
+    Weights* weights)
+{
+    weights->bytes = 1 + randomBelow(state, 4);
+    weights->duration = 1 + randomBelow(state, 4);
+    weights->interTime = 1 + randomBelow(state, 4);
+    weights->interLength = 1 + randomBelow(state, 4);
+
+    for (int i = 0; i < count; i++)
+    {
+        // sources are from few /24 networks, so partitions have more flows
+        addresses[2*i] = (10u << 24) | ((uint32_t)randomBelow(state, 4) << 8) | (uint32_t)randomBelow(state, 256);
+        addresses[2*i + 1] = (192u << 24) | (168u << 16) | (uint32_t)randomBelow(state, 1 << 16);
+
+        int bytes = 1 + randomBelow(state, 40000);
+        int duration = randomBelow(state, 500);
+        packets[i] = 1 + randomBelow(state, 300);
+        double interTime = randomBelow(state, 5000)/1000.0;
+
+        if (kind == tiedInput)
+        {
+            // values on small grid, so many ranges are equal
+            bytes = 1 + randomBelow(state, 3);
+            duration = randomBelow(state, 3);
+            packets[i] = 1;
+            interTime = randomBelow(state, 2);
+        }
+        else if (kind == duplicateInput && i > 0 && randomBelow(state, 2) == 0)
+        {
+            int original = randomBelow(state, i);
+            flows[i] = flows[original];
+            flows[i].flowID = i + 1;
+            flows[i].inputInx = i;
+            packets[i] = packets[original];
+            continue;
+        }
+        else if (kind == extremeInput)
+        {
+            int extremeBytes[3] = {1, INT32_MAX/2, INT32_MAX};
+            int extremeDurations[3] = {0, 1, INT32_MAX};
+            bytes = extremeBytes[randomBelow(state, 3)];
+            duration = extremeDurations[randomBelow(state, 3)];
+            packets[i] = randomBelow(state, 2) == 0 ? 1 : INT32_MAX;
+            interTime = randomBelow(state, 2) == 0 ? 1e-9 : 1e9;
+        }
+        else if (kind == overflowInput && randomBelow(state, 4) == 0)
+        {
+            // squares of differences of these features overflow to infinity,
+            // infinite ones also give differences which are not numbers
+            double hugeTimes[3] = {1e154, 1e200, INFINITY};
+            interTime = hugeTimes[randomBelow(state, 3)];
+        }
+        flows[i] = initFlow(i + 1, i, bytes, duration, packets[i], interTime);
+    }
+
+    if (kind == overflowInput && randomBelow(state, 4) == 0)
+    {
+        // zero weight of infinite feature
+        weights->interTime = 0;
+    }
+
+    if (kind == zeroWeightInput)
+    {
+        // at least one weight is zero, sometimes all of them
+        int zeroCount = 1 + randomBelow(state, 4);
+        for (int k = 0; k < zeroCount; k++)
+        {
+            int axis = randomBelow(state, 4);
+            if (axis == 0)
+            {
+                weights->bytes = 0;
+            }
+            else if (axis == 1)
+            {
+                weights->duration = 0;
+            }
+            else if (axis == 2)
+            {
+                weights->interTime = 0;
+            }
+            else
+            {
+                weights->interLength = 0;
+            }
+        }
+    }
+
+    // shuffles flowIDs (Fisher-Yates)
+    for (int i = count - 1; i > 0; i--)
+    {
+        int n = randomBelow(state, i + 1);
+        int tmp = flows[i].flowID;
+        flows[i].flowID = flows[n].flowID;
+        flows[n].flowID = tmp;
+    }
+}
+
+// forms storage with single flow clusters from flows
+int initStorageFromFlows(Flow* flows, int count, ClusterStorage* storage)
+{
+    storage->clusterCount = 0;
+    storage->clusters = malloc(sizeof(Cluster)*count);
+    if (storage->clusters == NULL)
+    {
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        storage->clusters[i] = initCluster(&flows[i], 1);
+        if (storage->clusters[i].flowCount == -1)
+        {
+            freeAll(storage, 0);
+            return 1;
+        }
+        storage->clusterCount++;
+    }
+    return 0;
+}
+
+// clusters flows with options and stores cluster of every flow by input order,
+// time of clustering is added to seconds
+int clusterForVerify(Flow* flows, int count, int destClusterCount, Weights weights, Options options,
+    int* assignment, double* seconds)
+{
+    ClusterStorage storage;
+    if (initStorageFromFlows(flows, count, &storage) != 0)
+    {
+        return 1;
+    }
+
+    double start = currentSeconds();
+    if (clusterToNGroups(destClusterCount, &storage, weights, options) != 0)
+    {
+        freeAll(&storage, 1);
+        return 1;
+    }
+    *seconds += currentSeconds() - start;
+
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        for (int n = 0; n < storage.clusters[i].flowCount; n++)
+        {
+            assignment[storage.clusters[i].flows[n].inputInx] = i;
+        }
+    }
+    freeAll(&storage, 1);
+    return 0;
+}
+
+// clusters flows with options and prints result to given output,
+// time of clustering is added to seconds
+int clusterOutForVerify(FILE* out, Flow* flows, int count, int destClusterCount, Weights weights,
+    Options options, double* seconds)
+{
+    ClusterStorage storage;
+    if (initStorageFromFlows(flows, count, &storage) != 0)
+    {
+        return 1;
+    }
+
+    double start = currentSeconds();
+    if (clusterToNGroups(destClusterCount, &storage, weights, options) != 0)
+    {
+        freeAll(&storage, 1);
+        return 1;
+    }
+    *seconds += currentSeconds() - start;
+
+    resultOut(out, storage, options);
+    freeAll(&storage, 1);
+    return 0;
+}
+
+// unites flows along edges of tree shorter than limit and stores root of every flow
+void componentsUnderRange(Edge* edges, int count, double limit, int* roots)
+{
+    for (int i = 0; i < count; i++)
+    {
+        roots[i] = i;
+    }
+    for (int i = 0; i < count - 1; i++)
+    {
+        if (edges[i].range < limit)
+        {
+            roots[findRoot(roots, edges[i].clusterA)] = findRoot(roots, edges[i].clusterB);
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        roots[i] = findRoot(roots, i);
+    }
+}
+
+// checks if tree is cut at place with equal ranges, only then can different engines
+// return different valid results
+bool isTiedCut(VerifyCase* vc, int destClusterCount)
+{
+    int cut = vc->count - destClusterCount;
+    return cut > 0 && cut < vc->count - 1 && vc->edges[cut].range == vc->edges[cut-1].range;
+}
+
+// checks that clustering is valid single linkage result with given count of clusters:
+// flows linked below range of first edge which is not used are together
+// and every cluster is linked by ranges which are not longer than it
+bool isValidResult(VerifyCase* vc, int* assignment, int destClusterCount)
+{
+    int count = vc->count;
+    int clusterCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        vc->firstOf[i] = -1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (vc->firstOf[assignment[i]] == -1)
+        {
+            vc->firstOf[assignment[i]] = i;
+            clusterCount++;
+        }
+    }
+    if (clusterCount != destClusterCount)
+    {
+        return false;
+    }
+    // single cluster has no edge which is not used
+    if (destClusterCount == 1)
+    {
+        return true;
+    }
+
+    double cutRange = vc->edges[count - destClusterCount].range;
+    componentsUnderRange(vc->edges, count, cutRange, vc->roots);
+    for (int i = 0; i < count; i++)
+    {
+        if (assignment[vc->roots[i]] != assignment[i])
+        {
+            return false;
+        }
+    }
+
+    // searches every cluster from its first flow, roots are no longer needed,
+    // so they mark reached flows
+    for (int i = 0; i < count; i++)
+    {
+        vc->roots[i] = 0;
+    }
+    for (int first = 0; first < count; first++)
+    {
+        if (vc->firstOf[assignment[first]] != first)
+        {
+            continue;
+        }
+        int queueSize = 1;
+        vc->queue[0] = first;
+        vc->roots[first] = 1;
+        for (int n = 0; n < queueSize; n++)
+        {
+            Flow flow = vc->flows[vc->queue[n]];
+            for (int i = first + 1; i < count; i++)
+            {
+                if (vc->roots[i] == 0 && assignment[i] == assignment[first] &&
+                    findRange(flow, vc->flows[i], vc->weights) <= cutRange)
+                {
+                    vc->roots[i] = 1;
+                    vc->queue[queueSize] = i;
+                    queueSize++;
+                }
+            }
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (vc->roots[i] == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// compares clusters of variant with reference, different result is accepted only
+// if tree is cut at equal ranges and it is valid, returns 0 if they are equal,
+// 2 if variant is wrong and 3 if it is different valid result
+int compareAssignments(VerifyCase* vc, int* expected, int destClusterCount)
+{
+    if (memcmp(expected, vc->got, sizeof(int)*vc->count) == 0)
+    {
+        return 0;
+    }
+    return isTiedCut(vc, destClusterCount) && isValidResult(vc, vc->got, destClusterCount) ? 3 : 2;
+}
+
+// returns count of clusters which are left when edges longer than max distance are not used
+int farClusterCount(VerifyCase* vc)
+{
+    int clusterCount = vc->count;
+    for (int i = 0; i < vc->count - 1; i++)
+    {
+        if (vc->edges[i].range <= vc->maxDistance)
+        {
+            clusterCount--;
+        }
+    }
+    return clusterCount > vc->destClusterCount ? clusterCount : vc->destClusterCount;
+}
+
+// writes flows of case in format of source file and clusters it as batch job does
+int clusterBatchForVerify(VerifyCase* vc, Options options, double* seconds)
+{
+    BatchJob job;
+    job.destClusterCount = vc->destClusterCount;
+    job.weights = vc->weights;
+    FILE* text = open_memstream(&job.data, &job.size);
+    if (text == NULL)
+    {
+        return 1;
+    }
+    fprintf(text, "count=%i\n", vc->count);
+    for (int i = 0; i < vc->count; i++)
+    {
+        uint32_t src = vc->addresses[2*i];
+        uint32_t dst = vc->addresses[2*i + 1];
+        fprintf(text, "%i %u.%u.%u.%u %u.%u.%u.%u %i %i %i %.17g\n", vc->flows[i].flowID,
+            src >> 24, (src >> 16) & 0xff, (src >> 8) & 0xff, src & 0xff,
+            dst >> 24, (dst >> 16) & 0xff, (dst >> 8) & 0xff, dst & 0xff,
+            vc->flows[i].totalBytes, vc->flows[i].flowDuration, vc->packets[i], vc->flows[i].avgInterTime);
+    }
+    fclose(text);
+
+    ClusterStorage storage;
+    double start = currentSeconds();
+    int result = clusterLoadedJob(&job, options, &storage);
+    *seconds += currentSeconds() - start;
+    free(job.data);
+    if (result != 0)
+    {
+        return 1;
+    }
+
+    for (int i = 0; i < storage.clusterCount; i++)
+    {
+        for (int n = 0; n < storage.clusters[i].flowCount; n++)
+        {
+            vc->got[storage.clusters[i].flows[n].inputInx] = i;
+        }
+    }
+    freeAll(&storage, 1);
+    return 0;
+}
+
+// prints output of variant which prints more results, time of it is added to seconds
+int variantOut(FILE* out, VerifyCase* vc, VerifyVariant* variant, double* seconds)
+{
+    double start = currentSeconds();
+    int result = 0;
+    if (variant->kind == weightsFileVariant)
+    {
+        result = clusterWithWeightVectors(out, vc->flows, vc->count, vc->sweepWeights, 3, vc->destClusterCount,
+            variant->options);
+    }
+    else
+    {
+        ClusterStorage storage;
+        if (initStorageFromFlows(vc->flows, vc->count, &storage) != 0)
+        {
+            return 1;
+        }
+        result = variant->kind == windowVariant ?
+            uniteInWindows(out, vc->destClusterCount, &storage, vc->weights, variant->options) :
+            uniteInPartitions(out, vc->destClusterCount, &storage, vc->addresses, vc->weights, variant->options);
+        freeAll(&storage, 0);
+    }
+    *seconds += currentSeconds() - start;
+    return result;
+}
+
+// prints expected output of variant which prints more results, every part of it is clustered
+// from scratch by reference, time of it is added to seconds
+int referenceOut(FILE* out, VerifyCase* vc, VerifyVariant* variant, Options reference, double* seconds)
+{
+    if (variant->kind == weightsFileVariant)
+    {
+        for (int v = 0; v < 3; v++)
+        {
+            Weights w = vc->sweepWeights[v];
+            fprintf(out, "Weights %g,%g,%g,%g:\n", w.bytes, w.duration, w.interTime, w.interLength);
+            if (clusterOutForVerify(out, vc->flows, vc->count, vc->destClusterCount, w, reference, seconds) != 0)
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    if (variant->kind == windowVariant)
+    {
+        // windows end at multiples of step after the first one and the last one ends with flows
+        for (int windowNumber = 0; ; windowNumber++)
+        {
+            int end = windowNumber*vc->windowStep + vc->windowSize;
+            end = end < vc->count ? end : vc->count;
+            int begin = end - vc->windowSize > 0 ? end - vc->windowSize : 0;
+            int size = end - begin;
+            fprintf(out, "Window %i (flows %i-%i):\n", windowNumber, begin, end - 1);
+            if (clusterOutForVerify(out, &vc->flows[begin], size, vc->destClusterCount < size ?
+                vc->destClusterCount : size, vc->weights, reference, seconds) != 0)
+            {
+                return 1;
+            }
+            if (end == vc->count)
+            {
+                return 0;
+            }
+        }
+    }
+
+    // generated sources differ only in third byte, so partitions are found by it
+    for (int network = 0; network < 4; network++)
+    {
+        Partition partition;
+        partition.key = (10u << 24) | ((uint32_t)network << 8);
+        int size = 0;
+        for (int i = 0; i < vc->count; i++)
+        {
+            if (maskAddress(vc->addresses[2*i], 24) == partition.key)
+            {
+                vc->partFlows[size] = vc->flows[i];
+                size++;
+            }
+        }
+        if (size == 0)
+        {
+            continue;
+        }
+        if (initStorageFromFlows(vc->partFlows, size, &partition.storage) != 0)
+        {
+            return 1;
+        }
+        double start = currentSeconds();
+        if (clusterToNGroups(vc->destClusterCount < size ? vc->destClusterCount : size, &partition.storage,
+            vc->weights, reference) != 0)
+        {
+            freeAll(&partition.storage, 1);
+            return 1;
+        }
+        *seconds += currentSeconds() - start;
+        partitionOut(out, partition, variant->options);
+        freeAll(&partition.storage, 1);
+    }
+    return 0;
+}
+
+// compares whole output of variant with output of reference, returns 0 if they are equal,
+// 1 if something failed and 2 if they differ
+int compareOutputs(VerifyCase* vc, VerifyVariant* variant, Options reference)
+{
+    char* expectedText = NULL;
+    char* gotText = NULL;
+    size_t expectedSize = 0;
+    size_t gotSize = 0;
+    FILE* expectedOut = open_memstream(&expectedText, &expectedSize);
+    FILE* gotOut = open_memstream(&gotText, &gotSize);
+
+    int result = expectedOut == NULL || gotOut == NULL;
+    if (result == 0)
+    {
+        result = referenceOut(expectedOut, vc, variant, reference, &variant->referenceSeconds) != 0 ||
+            variantOut(gotOut, vc, variant, &variant->seconds) != 0;
+    }
+    if (expectedOut != NULL)
+    {
+        fclose(expectedOut);
+    }
+    if (gotOut != NULL)
+    {
+        fclose(gotOut);
+    }
+    if (result == 0 && (expectedSize != gotSize || memcmp(expectedText, gotText, gotSize) != 0))
+    {
+        result = 2;
+    }
+
+    free(expectedText);
+    free(gotText);
+    return result;
+}
+
+// runs variant on case and compares it with reference,
+// returns 0 if they are equal, 1 if something failed, 2 if variant is wrong
+// and 3 if it is different valid result
+int verifyVariant(VerifyCase* vc, VerifyVariant* variant, Options reference, double referenceSeconds)
+{
+    switch (variant->kind)
+    {
+        case engineVariant:
+            variant->referenceSeconds += referenceSeconds;
+            if (clusterForVerify(vc->flows, vc->count, vc->destClusterCount, vc->weights, variant->options,
+                vc->got, &variant->seconds) != 0)
+            {
+                return 1;
+            }
+            return compareAssignments(vc, vc->expected, vc->destClusterCount);
+        case maxDistanceVariant:
+            variant->referenceSeconds += referenceSeconds;
+            variant->options.maxDistance = vc->maxDistance;
+            if (clusterForVerify(vc->flows, vc->count, vc->destClusterCount, vc->weights, variant->options,
+                vc->got, &variant->seconds) != 0)
+            {
+                return 1;
+            }
+            return compareAssignments(vc, vc->expectedFar, farClusterCount(vc));
+        case batchVariant:
+            variant->referenceSeconds += referenceSeconds;
+            if (clusterBatchForVerify(vc, variant->options, &variant->seconds) != 0)
+            {
+                return 1;
+            }
+            return compareAssignments(vc, vc->expected, vc->destClusterCount);
+        case windowVariant:
+            variant->options.windowSize = vc->windowSize;
+            variant->options.windowStep = vc->windowStep;
+            return compareOutputs(vc, variant, reference);
+        default:
+            return compareOutputs(vc, variant, reference);
+    }
+}
+
+// returns variant with given name, kind, engine and thread count
+VerifyVariant initVariant(const char* name, int kind, Options options, int engine, int threadCount)
+{
+    VerifyVariant variant;
+    variant.name = name;
+    variant.kind = kind;
+    variant.options = options;
+    variant.options.engine = engine;
+    variant.threadCount = threadCount;
+    variant.mismatchCount = 0;
+    variant.tieCount = 0;
+    variant.seconds = 0;
+    variant.referenceSeconds = 0;
+    return variant;
+}
+
+// frees arrays of verify mode
+void freeVerifyCase(VerifyCase* vc)
+{
+    free(vc->flows);
+    free(vc->packets);
+    free(vc->addresses);
+    free(vc->edges);
+    free(vc->expected);
+    free(vc->expectedFar);
+    free(vc->got);
+    free(vc->roots);
+    free(vc->firstOf);
+    free(vc->queue);
+    free(vc->partFlows);
+}
+
+// generates weights of case and limits of its modes, spanning tree of flows
+// tells where it is cut and max distance is taken from its edges
+int prepareVerifyCase(VerifyCase* vc, int kind, uint64_t* state)
+{
+    generateFlows(vc->flows, vc->packets, vc->addresses, vc->count, kind, state, &vc->weights);
+
+    vc->sweepWeights[0] = vc->weights;
+    for (int v = 1; v < 3; v++)
+    {
+        vc->sweepWeights[v].bytes = randomBelow(state, 5);
+        vc->sweepWeights[v].duration = randomBelow(state, 5);
+        vc->sweepWeights[v].interTime = randomBelow(state, 5);
+        vc->sweepWeights[v].interLength = 1 + randomBelow(state, 4);
+    }
+    vc->windowSize = 2 + randomBelow(state, vc->count - 1);
+    vc->windowStep = (vc->windowSize + 3)/4 + randomBelow(state, vc->windowSize - (vc->windowSize + 3)/4 + 1);
+
+    ClusterStorage storage;
+    if (initStorageFromFlows(vc->flows, vc->count, &storage) != 0 ||
+        buildSpanningTree(&storage, vc->weights, vc->edges) != 0)
+    {
+        return 1;
+    }
+    // tree is built on clusters in input order, so indexes of edges are input indexes
+    freeAll(&storage, 0);
+    sortEdges(vc->edges, vc->count - 1);
+    vc->maxDistance = vc->edges[randomBelow(state, vc->count - 1)].range;
+    return 0;
+}
+
+// compares every variant with reference on many generated inputs and prints report
+// with their mismatches and speedups, returns 1 if any variant differs
+int runVerifyMode(int argc, char* argv[], Options options)
+{
+    long caseCount = 100;
+    long seed = 1;
+    char* endptr;
+    if (argc > 4 ||
+        (argc > 2 && ((caseCount = strtol(argv[2], &endptr, 10)) <= 0 || *endptr != '\0')) ||
+        (argc > 3 && ((seed = strtol(argv[3], &endptr, 10)) < 0 || *endptr != '\0')))
+    {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        return 1;
+    }
+
+    int configuredThreads = taskScheduler.threadCount;
+    Options reference = options;
+    reference.engine = referenceEngine;
+    reference.compactKind = noCompact;
+    Options sourcePartitions = reference;
+    sourcePartitions.partitionBy = sourcePartition;
+    sourcePartitions.partitionPrefix = 24;
+
+    VerifyVariant variants[13];
+    int variantCount = 0;
+    variants[variantCount++] = initVariant("mst", engineVariant, reference, spanningTreeEngine, 1);
+    variants[variantCount++] = initVariant("mnn 1 thread", engineVariant, reference, nearestRoundsEngine, 1);
+    variants[variantCount++] = initVariant("mnn 2 threads", engineVariant, reference, nearestRoundsEngine, 2);
+    variants[variantCount++] = initVariant("mnn all threads", engineVariant, reference, nearestRoundsEngine,
+        configuredThreads);
+    variants[variantCount] = initVariant("mnn compact float", engineVariant, reference, nearestRoundsEngine, 1);
+    variants[variantCount++].options.compactKind = floatCompact;
+    variants[variantCount] = initVariant("mnn compact fixed16", engineVariant, reference, nearestRoundsEngine, 1);
+    variants[variantCount++].options.compactKind = fixed16Compact;
+    variants[variantCount++] = initVariant("mst all threads", engineVariant, reference, spanningTreeEngine,
+        configuredThreads);
+    variants[variantCount++] = initVariant("mst max distance", maxDistanceVariant, reference,
+        spanningTreeEngine, 1);
+    variants[variantCount++] = initVariant("mnn max distance", maxDistanceVariant, reference,
+        nearestRoundsEngine, 1);
+    variants[variantCount++] = initVariant("batch mst", batchVariant, reference, spanningTreeEngine, 1);
+    variants[variantCount++] = initVariant("weights file", weightsFileVariant, reference, spanningTreeEngine, 1);
+    variants[variantCount++] = initVariant("window", windowVariant, reference, spanningTreeEngine, 1);
+    variants[variantCount++] = initVariant("partition mst all threads", partitionVariant, sourcePartitions,
+        spanningTreeEngine, configuredThreads);
+
+    const char* kindNames[verifyInputKindCount] = {"random", "tied", "zero weights", "duplicates", "extreme",
+        "overflow"};
+    const int maxCount = 400;
+    VerifyCase vc;
+    vc.flows = malloc(sizeof(Flow)*maxCount);
+    vc.packets = malloc(sizeof(int)*maxCount);
+    vc.addresses = malloc(sizeof(uint32_t)*2*maxCount);
+    vc.edges = malloc(sizeof(Edge)*maxCount);
+    vc.expected = malloc(sizeof(int)*maxCount);
+    vc.expectedFar = malloc(sizeof(int)*maxCount);
+    vc.got = malloc(sizeof(int)*maxCount);
+    vc.roots = malloc(sizeof(int)*maxCount);
+    vc.firstOf = malloc(sizeof(int)*maxCount);
+    vc.queue = malloc(sizeof(int)*maxCount);
+    vc.partFlows = malloc(sizeof(Flow)*maxCount);
+
+    // allocation check
+    if (vc.flows == NULL || vc.packets == NULL || vc.addresses == NULL || vc.edges == NULL ||
+        vc.expected == NULL || vc.expectedFar == NULL || vc.got == NULL || vc.roots == NULL ||
+        vc.firstOf == NULL || vc.queue == NULL || vc.partFlows == NULL)
+    {
+        freeVerifyCase(&vc);
+        fprintf(stderr, "ERROR: Some allocation failed\n");
+        return 1;
+    }
+
+    uint64_t state = (uint64_t)seed;
+    int result = 0;
+    printf("Verify:\n");
+    // failure stops verification, mismatches are only reported
+    for (long c = 0; c < caseCount && result != 1; c++)
+    {
+        int kind = (int)(c % verifyInputKindCount);
+        vc.count = 2 + randomBelow(&state, maxCount - 1);
+        vc.destClusterCount = 1 + randomBelow(&state, vc.count);
+        if (prepareVerifyCase(&vc, kind, &state) != 0)
+        {
+            result = 1;
+            break;
+        }
+
+        // reference is checked too, with max distance it stops at count given by tree
+        Options far = reference;
+        far.maxDistance = vc.maxDistance;
+        double referenceSeconds = 0;
+        double farSeconds = 0;
+        if (clusterForVerify(vc.flows, vc.count, vc.destClusterCount, vc.weights, reference, vc.expected,
+            &referenceSeconds) != 0 ||
+            clusterForVerify(vc.flows, vc.count, vc.destClusterCount, vc.weights, far, vc.expectedFar,
+            &farSeconds) != 0)
+        {
+            result = 1;
+            break;
+        }
+        if (!isValidResult(&vc, vc.expected, vc.destClusterCount) ||
+            !isValidResult(&vc, vc.expectedFar, farClusterCount(&vc)))
+        {
+            printf("case %li (%s, %i flows, N=%i): reference result is not valid\n", c, kindNames[kind],
+                vc.count, vc.destClusterCount);
+            result = 2;
+        }
+
+        for (int v = 0; v < variantCount; v++)
+        {
+            // pool is restarted with thread count of variant
+            if (taskScheduler.threadCount != variants[v].threadCount)
+            {
+                stopScheduler(false);
+                if (startScheduler(variants[v].threadCount) != 0)
+                {
+                    result = 1;
+                    break;
+                }
+            }
+
+            int comparison = verifyVariant(&vc, &variants[v], reference,
+                variants[v].kind == maxDistanceVariant ? farSeconds : referenceSeconds);
+            if (comparison == 1)
+            {
+                result = 1;
+                break;
+            }
+            if (comparison == 3)
+            {
+                variants[v].tieCount++;
+            }
+            if (comparison == 2)
+            {
+                variants[v].mismatchCount++;
+                printf("case %li (%s, %i flows, N=%i): %s differs from reference\n", c, kindNames[kind],
+                    vc.count, vc.destClusterCount, variants[v].name);
+                result = 2;
+            }
+        }
+    }
+
+    // pool is returned to its configured size
+    if (taskScheduler.threadCount != configuredThreads)
+    {
+        stopScheduler(false);
+        startScheduler(configuredThreads);
+    }
+
+    if (result != 1)
+    {
+        printf("Engines (%li cases):\n", caseCount);
+        for (int v = 0; v < variantCount; v++)
+        {
+            printf("%s: %i mismatches, %i different tied results, %.6f s, reference %.6f s, speedup %.2f\n",
+                variants[v].name, variants[v].mismatchCount, variants[v].tieCount, variants[v].seconds,
+                variants[v].referenceSeconds,
+                variants[v].seconds > 0 ? variants[v].referenceSeconds/variants[v].seconds : 0);
+        }
+    }
+    else
+    {
+        fprintf(stderr, "ERROR: Some failure stopped verification\n");
+    }
+
+    freeVerifyCase(&vc);
+    return result != 0;
+}
+
+// Functions for clustering with many weight vectors in one run
+// -------------------------------------------------------------------------------------
+
+// count of nearest neighbours kept for every flow and weight vector
+#define SWEEP_NEIGHBOURS 32
+
+// bytes of arrays of weight vectors which are clustered at the same time,
+// vectors are clustered in batches, so memory does not grow with their count
+#define SWEEP_BATCH_BYTES (64L << 20)
+
+// structure for sharing spanning tree rounds of all weight vectors between tasks
+typedef struct SWeightSweep
+{
+    int flowCount;
+    // 4 features of every flow, squared differences of them are shared by all vectors
+    double* features;
+    Weights* weights;
+    int weightCount;
+    // nearest neighbours of every flow sorted by edge order, neighbourCount for every flow
+    int neighbourCount;
+    Edge* neighbours;
+    // squared range of farthest kept neighbour of every flow for every vector
+    double* lastSums;
+    // arrays with flowCount items for every weight vector one after another
+    int* parent;
+    int* component;
+    Edge* candidates;
+    Edge* shortest;
+    // rows whose nearest neighbours are all in their own cluster are searched again
+    bool* needsScan;
+    // tree edges of every vector, flowCount-1 of them for every vector
+    Edge* edges;
+    int* edgeCounts;
+}WeightSweep;
+// loads weight vectors from file, one vector per line as WB WT WD WS,
+// empty lines and lines starting with # are skipped
+int collectWeightsFromFile(const char* fileName, Weights** weightsOut, int* weightCountOut)
+{
+    FILE* file = fopen(fileName, "r");
+    if (file == NULL)
+    {
+        return 1;
+    }
+
+    Weights* weights = NULL;
+    int weightCount = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char* start = line;
+        while (isspace((unsigned char)*start))
+        {
+            start++;
+        }
+        if (*start == '\0' || *start == '#')
+        {
+            continue;
+        }
+
+        Weights w;
+        int readCount = 0;
+        if (sscanf(start, "%lf %lf %lf %lf %n", &w.bytes, &w.duration, &w.interTime, &w.interLength,
+                &readCount) != 4 || start[readCount] != '\0' ||
+            w.bytes < 0 || w.duration < 0 || w.interTime < 0 || w.interLength < 0)
+        {
+            free(weights);
+            fclose(file);
+            return 1;
+        }
+
+        Weights* tmp = realloc(weights, sizeof(Weights)*(weightCount + 1));
+        if (tmp == NULL)
+        {
+            free(weights);
+            fclose(file);
+            return 1;
+        }
+        weights = tmp;
+        weights[weightCount] = w;
+        weightCount++;
+    }
+    fclose(file);
+
+    if (weightCount == 0)
+    {
+        return 1;
+    }
+    *weightsOut = weights;
+    *weightCountOut = weightCount;
+    return 0;
+}
+
+void freeWeightSweep(WeightSweep* sweep)
+{
+    freeLarge(sweep->features);
+    freeLarge(sweep->neighbours);
+    freeLarge(sweep->lastSums);
+    free(sweep->parent);
+    free(sweep->component);
+    free(sweep->candidates);
+    free(sweep->shortest);
+    free(sweep->needsScan);
+    free(sweep->edges);
+    free(sweep->edgeCounts);
+}
+
+// calculates squared differences of features between flow and 64 wide block of flows
+void sweepDifferences(WeightSweep* sweep, int flow, int colBegin, int colEnd, double diffs[64][4])
+{
+    const double* a = &sweep->features[(size_t)flow*4];
+    for (int j = colBegin; j < colEnd; j++)
+    {
+        const double* b = &sweep->features[(size_t)j*4];
+        for (int k = 0; k < 4; k++)
+        {
+            diffs[j - colBegin][k] = squareFloat(a[k] - b[k]);
+        }
+    }
+}
+
+// returns weighted sum of squared differences, terms are summed in same order
+// as in findRange, so square root of it is the same range (also if it is not a number)
+double sweepSum(Weights w, const double* d)
+{
+    double sum = w.bytes*d[0] + w.duration*d[1] + w.interTime*d[2] + w.interLength*d[3];
+    if (isnan(sum))
+    {
+        sum = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            if (getWeight(w, k) != 0)
+            {
+                sum += isnan(getWeight(w, k)*d[k]) ? INFINITY : getWeight(w, k)*d[k];
+            }
+        }
+    }
+    return sum;
+}
+
+// inserts edge into sorted nearest neighbours of flow for one vector if it is shorter
+// than the farthest of them, which falls out of list then
+void insertSweepNeighbour(WeightSweep* sweep, int v, int flow, Edge edge)
+{
+    int kept = sweep->neighbourCount;
+    size_t item = (size_t)v*sweep->flowCount + flow;
+    Edge* list = &sweep->neighbours[item*kept];
+    if (!isMissingEdge(list[kept-1]) && !isShorterEdge(edge, list[kept-1]))
+    {
+        return;
+    }
+
+    // even infinite edge takes place of missing one
+    int position = kept - 1;
+    while (position > 0 && (isMissingEdge(list[position-1]) || isShorterEdge(edge, list[position-1])))
+    {
+        list[position] = list[position-1];
+        position--;
+    }
+    list[position] = edge;
+    sweep->lastSums[item] = list[kept-1].range*list[kept-1].range;
+}
+
+// updates nearest neighbours of flows of 2 blocks by pairs between them for all vectors,
+// squared differences of every pair are calculated only once for all vectors
+void updateSweepTile(WeightSweep* sweep, int blockA, int blockB)
+{
+    int count = sweep->flowCount;
+    int beginA = blockA*64;
+    int endA = beginA + 64 < count ? beginA + 64 : count;
+    int beginB = blockB*64;
+    int endB = beginB + 64 < count ? beginB + 64 : count;
+    double diffs[64][4];
+    TRACE_START(traceStart);
+
+    for (int i = beginA; i < endA; i++)
+    {
+        // pairs inside one block are taken only once too
+        int colBegin = blockA == blockB ? i + 1 : beginB;
+        sweepDifferences(sweep, i, colBegin, endB, diffs);
+
+        for (int v = 0; v < sweep->weightCount; v++)
+        {
+            Weights w = sweep->weights[v];
+            const double* lastSums = &sweep->lastSums[(size_t)v*count];
+            for (int j = colBegin; j < endB; j++)
+            {
+                double sum = sweepSum(w, diffs[j - colBegin]);
+                bool isNearI = sum <= lastSums[i]*(1 + 1e-12);
+                bool isNearJ = sum <= lastSums[j]*(1 + 1e-12);
+                if (!isNearI && !isNearJ)
+                {
+                    continue;
+                }
+                Edge edge = initEdge(i, j, sqrt(sum));
+                if (isNearI)
+                {
+                    insertSweepNeighbour(sweep, v, i, edge);
+                }
+                if (isNearJ)
+                {
+                    insertSweepNeighbour(sweep, v, j, edge);
+                }
+            }
+        }
+    }
+    TRACE_SPAN("distance block", traceStart, endA - beginA, endB - beginB, NAN, sweep->weightCount);
+}
+
+// structure for sharing one phase of nearest neighbours search between tasks,
+// no block is in 2 tiles of one phase, so tasks never update same flows
+typedef struct SSweepPhase
+{
+    WeightSweep* sweep;
+    int blockCount;
+    // even count of blocks used for pairing, last one is empty if blockCount is odd
+    int pairedCount;
+    // -1 means that every block is paired with itself
+    int phase;
+}SweepPhase;
+
+// updates nearest neighbours by tiles of part of phase (round-robin pairing of blocks)
+void updateSweepPhase(void* context, int begin, int end)
+{
+    SweepPhase* phase = context;
+    int last = phase->pairedCount - 1;
+
+    for (int k = begin; k < end; k++)
+    {
+        int blockA = k;
+        int blockB = k;
+        if (phase->phase >= 0)
+        {
+            blockA = k == 0 ? last : (phase->phase + k) % last;
+            blockB = k == 0 ? phase->phase : (phase->phase - k + last) % last;
+        }
+        if (blockA < phase->blockCount && blockB < phase->blockCount)
+        {
+            updateSweepTile(phase->sweep, blockA, blockB);
+        }
+    }
+}
+
+// finds nearest neighbours of all flows for all vectors, every pair of 64 wide
+// blocks is one tile and tiles of one phase are processed in parallel
+void findSweepNeighbours(WeightSweep* sweep)
+{
+    int count = sweep->flowCount;
+    size_t itemCount = (size_t)sweep->weightCount*count;
+
+    // lists start filled with empty edges, which are longer than any real one
+    for (size_t item = 0; item < itemCount; item++)
+    {
+        int flow = (int)(item % count);
+        for (int k = 0; k < sweep->neighbourCount; k++)
+        {
+            sweep->neighbours[item*sweep->neighbourCount + k] = initEdge(flow, flow, INFINITY);
+        }
+        sweep->lastSums[item] = INFINITY;
+    }
+
+    SweepPhase phase;
+    phase.sweep = sweep;
+    phase.blockCount = (count + 63)/64;
+    phase.pairedCount = phase.blockCount + phase.blockCount % 2;
+    phase.phase = -1;
+    parallelFor(phase.blockCount, 1, updateSweepPhase, &phase);
+    for (phase.phase = 0; phase.phase < phase.pairedCount - 1; phase.phase++)
+    {
+        parallelFor(phase.pairedCount/2, 1, updateSweepPhase, &phase);
+    }
+}
+
+// finds shortest edge to other cluster for rows of part of 64 rows wide blocks,
+// which could not be found from their nearest neighbours
+void scanSweepRows(void* context, int begin, int end)
+{
+    WeightSweep* sweep = context;
+    int count = sweep->flowCount;
+    double diffs[64][4];
+
+    for (int block = begin; block < end; block++)
+    {
+        int rowBegin = block*64;
+        int rowEnd = rowBegin + 64 < count ? rowBegin + 64 : count;
+        for (int i = rowBegin; i < rowEnd; i++)
+        {
+            bool isNeeded = false;
+            for (int v = 0; v < sweep->weightCount; v++)
+            {
+                isNeeded = isNeeded || sweep->needsScan[(size_t)v*count + i];
+            }
+            if (!isNeeded)
+            {
+                continue;
+            }
+
+            for (int colBegin = 0; colBegin < count; colBegin += 64)
+            {
+                int colEnd = colBegin + 64 < count ? colBegin + 64 : count;
+                sweepDifferences(sweep, i, colBegin, colEnd, diffs);
+
+                for (int v = 0; v < sweep->weightCount; v++)
+                {
+                    if (!sweep->needsScan[(size_t)v*count + i])
+                    {
+                        continue;
+                    }
+                    const int* component = &sweep->component[(size_t)v*count];
+                    Edge* best = &sweep->shortest[(size_t)v*count + i];
+                    Weights w = sweep->weights[v];
+                    if (colBegin == 0)
+                    {
+                        *best = initEdge(i, i, INFINITY);
+                    }
+                    double bestSum = best->range*best->range;
+
+                    for (int j = colBegin; j < colEnd; j++)
+                    {
+                        if (component[j] == component[i])
+                        {
+                            continue;
+                        }
+                        double sum = sweepSum(w, diffs[j - colBegin]);
+                        if (sum > bestSum*(1 + 1e-12))
+                        {
+                            continue;
+                        }
+                        Edge edge = initEdge(i, j, sqrt(sum));
+                        if (isMissingEdge(*best) || isShorterEdge(edge, *best))
+                        {
+                            *best = edge;
+                            bestSum = sum;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// finds shortest edge leaving every cluster of one vector from nearest neighbours,
+// rows which have to be searched again are marked, returns if there are some
+bool collectSweepCandidates(WeightSweep* sweep, int v)
+{
+    int count = sweep->flowCount;
+    int kept = sweep->neighbourCount;
+    const int* component = &sweep->component[(size_t)v*count];
+    Edge* candidates = &sweep->candidates[(size_t)v*count];
+    bool* needsScan = &sweep->needsScan[(size_t)v*count];
+
+    for (int i = 0; i < count; i++)
+    {
+        candidates[i] = initEdge(i, i, INFINITY);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        const Edge* list = &sweep->neighbours[((size_t)v*count + i)*kept];
+        needsScan[i] = true;
+        for (int k = 0; k < kept; k++)
+        {
+            int other = list[k].clusterA == i ? list[k].clusterB : list[k].clusterA;
+            if (component[other] != component[i])
+            {
+                if (isMissingEdge(candidates[component[i]]) || isShorterEdge(list[k], candidates[component[i]]))
+                {
+                    candidates[component[i]] = list[k];
+                }
+                needsScan[i] = false;
+                break;
+            }
+        }
+    }
+
+    // other edges of row are not shorter than its farthest neighbour,
+    // so row is not needed if its cluster already has shorter edge,
+    // list which is not full holds all edges of row
+    bool isScanNeeded = false;
+    for (int i = 0; i < count; i++)
+    {
+        Edge farthest = sweep->neighbours[((size_t)v*count + i)*kept + kept-1];
+        Edge candidate = candidates[component[i]];
+        if (needsScan[i] && (isMissingEdge(farthest) ||
+            (!isMissingEdge(candidate) && isShorterEdge(candidate, farthest))))
+        {
+            needsScan[i] = false;
+        }
+        isScanNeeded = isScanNeeded || needsScan[i];
+    }
+    return isScanNeeded;
+}
+
+// builds minimum spanning trees for all weight vectors in common rounds (Boruvka),
+// ranges of pairs are calculated in one pass for all vectors, later rounds use
+// nearest neighbours of flows and search only rows whose neighbours were used up
+void buildSweepTrees(WeightSweep* sweep)
+{
+    int count = sweep->flowCount;
+    size_t itemCount = (size_t)sweep->weightCount*count;
+    if (count < 2)
+    {
+        return;
+    }
+
+    findSweepNeighbours(sweep);
+    for (size_t i = 0; i < itemCount; i++)
+    {
+        sweep->parent[i] = (int)(i % count);
+    }
+
+    bool isFinished = false;
+    while (!isFinished)
+    {
+        bool isScanNeeded = false;
+        for (int v = 0; v < sweep->weightCount; v++)
+        {
+            bool* needsScan = &sweep->needsScan[(size_t)v*count];
+            if (sweep->edgeCounts[v] == count - 1)
+            {
+                memset(needsScan, 0, sizeof(bool)*count);
+                continue;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                sweep->component[(size_t)v*count + i] = findRoot(&sweep->parent[(size_t)v*count], i);
+            }
+            isScanNeeded = collectSweepCandidates(sweep, v) || isScanNeeded;
+        }
+
+        if (isScanNeeded)
+        {
+            parallelFor((count + 63)/64, 1, scanSweepRows, sweep);
+        }
+
+        // shortest edge of every cluster is added to its vector's tree
+        isFinished = true;
+        for (int v = 0; v < sweep->weightCount; v++)
+        {
+            if (sweep->edgeCounts[v] == count - 1)
+            {
+                continue;
+            }
+            int* parent = &sweep->parent[(size_t)v*count];
+            int* component = &sweep->component[(size_t)v*count];
+            Edge* candidates = &sweep->candidates[(size_t)v*count];
+            Edge* edges = &sweep->edges[(size_t)v*(count - 1)];
+
+            for (int i = 0; i < count; i++)
+            {
+                Edge scanned = sweep->shortest[(size_t)v*count + i];
+                if (sweep->needsScan[(size_t)v*count + i] && !isMissingEdge(scanned) &&
+                    (isMissingEdge(candidates[component[i]]) || isShorterEdge(scanned, candidates[component[i]])))
+                {
+                    candidates[component[i]] = scanned;
+                }
+            }
+            int edgeCount = sweep->edgeCounts[v];
+            for (int i = 0; i < count; i++)
+            {
+                if (component[i] != i || isMissingEdge(candidates[i]))
+                {
+                    continue;
+                }
+                int rootA = findRoot(parent, candidates[i].clusterA);
+                int rootB = findRoot(parent, candidates[i].clusterB);
+
+                // mutual nearest neighbours find the same edge, it is added only once
+                if (rootA != rootB)
+                {
+                    parent[rootA] = rootB;
+                    edges[sweep->edgeCounts[v]] = candidates[i];
+                    sweep->edgeCounts[v]++;
+                }
+            }
+
+            // if no edge was added, remaining clusters are linked by infinite edges, as in mnn engine
+            if (sweep->edgeCounts[v] == edgeCount)
+            {
+                for (int i = 1; i < count; i++)
+                {
+                    int rootA = findRoot(parent, 0);
+                    int rootB = findRoot(parent, i);
+                    if (rootA != rootB)
+                    {
+                        parent[rootB] = rootA;
+                        edges[sweep->edgeCounts[v]] = initEdge(0, i, INFINITY);
+                        sweep->edgeCounts[v]++;
+                    }
+                }
+            }
+            isFinished = isFinished && sweep->edgeCounts[v] == count - 1;
+        }
+    }
+}
+
+// structure for sharing cutting of trees of all weight vectors between tasks
+typedef struct SSweepCut
+{
+    WeightSweep* sweep;
+    ClusterStorage* storages;
+    int destClusterCount;
+    double maxDistance;
+    int* results;
+}SweepCut;
+
+// unites flows along tree of every vector of part to wanted count
+void cutSweepTrees(void* context, int begin, int end)
+{
+    SweepCut* cut = context;
+    int count = cut->sweep->flowCount;
+
+    for (int v = begin; v < end; v++)
+    {
+        ClusterStorage* storage = &cut->storages[v];
+        if (cut->results[v] != 0)
+        {
+            continue;
+        }
+        if (count > 1)
+        {
+            cut->results[v] = cutSpanningTree(storage, &cut->sweep->edges[(size_t)v*(count - 1)],
+                cut->destClusterCount, cut->maxDistance);
+        }
+        sortClustersByID(storage->clusters, storage->clusterCount);
+    }
+}
+
+// clusters flows with every weight vector and prints result of every vector to given output,
+// vectors are clustered in batches, results of batch are printed before next one is started
+int clusterWithWeightVectors(FILE* out, Flow* flows, int count, Weights* weights, int weightCount,
+    int destClusterCount, Options options)
+{
+    // every vector needs its nearest neighbours, tree arrays and result clusters
+    int neighbourCount = count - 1 < SWEEP_NEIGHBOURS ? count - 1 : SWEEP_NEIGHBOURS;
+    size_t vectorBytes = (size_t)count*(sizeof(Edge)*(neighbourCount + 4) + sizeof(double) + 2*sizeof(int) +
+        sizeof(bool) + sizeof(Cluster) + sizeof(Flow));
+    long batchSize = SWEEP_BATCH_BYTES/(long)vectorBytes;
+    batchSize = batchSize < 1 ? 1 : batchSize > weightCount ? weightCount : batchSize;
+    int batchCapacity = (int)batchSize;
+
+    WeightSweep sweep;
+    sweep.flowCount = count;
+    sweep.features = allocateLarge(sizeof(double)*4*count, "sweep features");
+    sweep.neighbourCount = neighbourCount;
+    sweep.neighbours = allocateLarge(sizeof(Edge)*batchCapacity*count*
+        (sweep.neighbourCount > 0 ? sweep.neighbourCount : 1), "sweep neighbours");
+    sweep.lastSums = allocateLarge(sizeof(double)*batchCapacity*count, "sweep neighbours");
+    sweep.parent = malloc(sizeof(int)*batchCapacity*count);
+    sweep.component = malloc(sizeof(int)*batchCapacity*count);
+    sweep.candidates = malloc(sizeof(Edge)*batchCapacity*count);
+    sweep.shortest = malloc(sizeof(Edge)*batchCapacity*count);
+    sweep.needsScan = malloc(sizeof(bool)*batchCapacity*count);
+    sweep.edges = malloc(sizeof(Edge)*batchCapacity*count);
+    sweep.edgeCounts = malloc(sizeof(int)*batchCapacity);
+    ClusterStorage* storages = malloc(sizeof(ClusterStorage)*batchCapacity);
+    int* results = malloc(sizeof(int)*batchCapacity);
+
+    // allocation check
+    if (sweep.features == NULL || sweep.neighbours == NULL || sweep.lastSums == NULL ||
+        sweep.parent == NULL || sweep.component == NULL || sweep.candidates == NULL ||
+        sweep.shortest == NULL || sweep.needsScan == NULL || sweep.edges == NULL ||
+        sweep.edgeCounts == NULL || storages == NULL || results == NULL)
+    {
+        free(storages);
+        free(results);
+        freeWeightSweep(&sweep);
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            sweep.features[(size_t)i*4 + k] = getFeature(flows[i], k);
+        }
+    }
+
+    int result = 0;
+    for (int first = 0; first < weightCount && result == 0; first += batchCapacity)
+    {
+        sweep.weights = &weights[first];
+        sweep.weightCount = weightCount - first < batchCapacity ? weightCount - first : batchCapacity;
+        memset(sweep.edgeCounts, 0, sizeof(int)*sweep.weightCount);
+        buildSweepTrees(&sweep);
+
+        // every vector gets its own storage with single flow clusters
+        for (int v = 0; v < sweep.weightCount; v++)
+        {
+            results[v] = initStorageFromFlows(flows, count, &storages[v]);
+            if (results[v] != 0)
+            {
+                storages[v].clusterCount = 0;
+                storages[v].clusters = NULL;
+                result = 1;
+            }
+        }
+        if (result == 0)
+        {
+            // trees of all vectors are cut at the same time
+            SweepCut cut;
+            cut.sweep = &sweep;
+            cut.storages = storages;
+            cut.destClusterCount = destClusterCount;
+            cut.maxDistance = options.maxDistance;
+            cut.results = results;
+            parallelFor(sweep.weightCount, 1, cutSweepTrees, &cut);
+
+            for (int v = 0; v < sweep.weightCount; v++)
+            {
+                result |= results[v];
+            }
+        }
+
+        for (int v = 0; v < sweep.weightCount; v++)
+        {
+            if (result == 0)
+            {
+                Weights w = sweep.weights[v];
+                fprintf(out, "Weights %g,%g,%g,%g:\n", w.bytes, w.duration, w.interTime, w.interLength);
+                resultOut(out, storages[v], options);
+            }
+            freeAll(&storages[v], 1);
+        }
+    }
+
+    free(storages);
+    free(results);
+    freeWeightSweep(&sweep);
+    return result;
+}
+
+// clusters flows of file with every weight vector from weights file and prints
+// result of every vector, flows are loaded only once
+int runWeightSweep(int argc, char* argv[], Options options)
+{
+    char *endptr;
+    long destClusterCount = argc == 3 ? strtol(argv[2], &endptr, 10) : 0;
+    if (argc != 3 || *endptr != '\0' || destClusterCount <= 0 || destClusterCount > INT32_MAX)
+    {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        return 1;
+    }
+
+    Weights* weights;
+    int weightCount;
+    if (collectWeightsFromFile(options.weightsFile, &weights, &weightCount) != 0)
+    {
+        fprintf(stderr, "ERROR: Something is wrong with weights file\n");
+        return 1;
+    }
+
+    ClusterStorage storage;
+    if (loadStorageFromFile(argv[1], &storage, NULL) != 0)
+    {
+        free(weights);
+        return 1;
+    }
+    if (destClusterCount > storage.clusterCount)
+    {
+        free(weights);
+        finishProgram(afterRead, 1, 0, &storage, 0);
+        return 1;
+    }
+
+    // flows are taken out of single flow clusters in input order
+    int count = storage.clusterCount;
+    Flow* flows = malloc(sizeof(Flow)*count);
+    if (flows == NULL)
+    {
+        free(weights);
+        finishProgram(afterRead, 1, 0, &storage, 0);
+        return 1;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        flows[i] = storage.clusters[i].flows[0];
+    }
+    freeAll(&storage, 0);
+
+    int result = clusterWithWeightVectors(stdout, flows, count, weights, weightCount, (int)destClusterCount, options);
+    if (result != 0)
+    {
+        fprintf(stderr, "ERROR: Some allocation failed\n");
+    }
 
-    // unsuccessful allocation check
-    if (tmp == NULL)
+    free(flows);
+    free(weights);
+    return result;
+}
+
+// Functions for approximate clustering
+// -------------------------------------------------------------------------------------
+
+// structure for storing grid cells of approximate clustering
+typedef struct SCoreset
+{
+    // cell of every cluster of storage
+    int* cellOf;
+    // index of first cluster in every cell, it is representative of cell
+    int* cellFirst;
+    int* cellSize;
+    int64_t* cellKeys;
+    int cellCount;
+}Coreset;
+
+void freeCoreset(Coreset* coreset)
+{
+    free(coreset->cellOf);
+    free(coreset->cellFirst);
+    free(coreset->cellSize);
+    free(coreset->cellKeys);
+}
+
+// sorts flows into cells of grid in space of features scaled by square roots of weights,
+// cells have side EPS/2, so every flow is at most EPS far from any flow of its cell,
+// returns 1 if allocation failed and 2 if EPS is too small for features
+int buildCoreset(ClusterStorage* storage, Weights weights, double eps, Coreset* coreset)
+{
+    int count = storage->clusterCount;
+
+    // table size is power of 2 which is at least twice bigger than cluster count
+    size_t tableSize = 1;
+    while (tableSize < 2*(size_t)count)
     {
-        free(tmp1);
+        tableSize <<= 1;
+    }
+
+    int* table = malloc(sizeof(int)*tableSize);
+    coreset->cellOf = malloc(sizeof(int)*count);
+    coreset->cellFirst = malloc(sizeof(int)*count);
+    coreset->cellSize = calloc(count, sizeof(int));
+    coreset->cellKeys = malloc(sizeof(int64_t)*4*count);
+    coreset->cellCount = 0;
+
+    // allocation check
+    if (table == NULL || coreset->cellOf == NULL || coreset->cellFirst == NULL ||
+        coreset->cellSize == NULL || coreset->cellKeys == NULL)
+    {
+        free(table);
+        freeCoreset(coreset);
         return 1;
     }
 
-    // putting new range array to united cluster
-    unitedCluster->ranges = tmp;
+    // -1 marks empty slot, other values are cell indexes
+    for (size_t i = 0; i < tableSize; i++)
+    {
+        table[i] = -1;
+    }
 
-    // sot ranges inside cluster
-    sortRangesInCluster(unitedCluster);
+    double side = eps/2;
+    for (int i = 0; i < count; i++)
+    {
+        int64_t key[4];
+        uint64_t hash = 0;
+        for (int k = 0; k < 4; k++)
+        {
+            double position = floor(sqrt(getWeight(weights, k))*getFeature(storage->clusters[i].flows[0], k)/side);
+            if (!(fabs(position) < 9e18))
+            {
+                free(table);
+                freeCoreset(coreset);
+                return 2;
+            }
+            key[k] = (int64_t)position;
+            hash = mixBits(hash ^ (uint64_t)key[k]);
+        }
+
+        // finds cell using open addressing with linear probing
+        size_t slot = hash & (tableSize - 1);
+        while (table[slot] != -1 && memcmp(&coreset->cellKeys[(size_t)table[slot]*4], key, sizeof(key)) != 0)
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+
+        // opens new cell if it was not seen yet
+        if (table[slot] == -1)
+        {
+            table[slot] = coreset->cellCount;
+            coreset->cellFirst[coreset->cellCount] = i;
+            memcpy(&coreset->cellKeys[(size_t)coreset->cellCount*4], key, sizeof(key));
+            coreset->cellCount++;
+        }
+        coreset->cellOf[i] = table[slot];
+        coreset->cellSize[table[slot]] += storage->clusters[i].flowCount;
+    }
 
+    free(table);
     return 0;
 }
 
-// unites 2 clusters
-Cluster uniteClusters(Cluster clusterA, Cluster clusterB)
+// returns count of flows with distinct features, exact clustering collapses identical
+// flows too, so only these are clustered by it (returns count of clusters if allocation failed)
+int countDistinctFlows(ClusterStorage* storage)
+{
+    int count = storage->clusterCount;
+    size_t tableSize = 1;
+    while (tableSize < 2*(size_t)count)
+    {
+        tableSize <<= 1;
+    }
+    int* table = malloc(sizeof(int)*tableSize);
+    if (table == NULL)
+    {
+        return count;
+    }
+    for (size_t i = 0; i < tableSize; i++)
+    {
+        table[i] = -1;
+    }
+
+    int distinctCount = 0;
+    for (int i = 0; i < count; i++)
+    {
+        Flow flow = storage->clusters[i].flows[0];
+        size_t slot = hashFeatures(flow) & (tableSize - 1);
+        while (table[slot] != -1 && !haveSameFeatures(storage->clusters[table[slot]].flows[0], flow))
+        {
+            slot = (slot + 1) & (tableSize - 1);
+        }
+        if (table[slot] == -1)
+        {
+            table[slot] = i;
+            distinctCount++;
+        }
+    }
+    free(table);
+    return distinctCount;
+}
+
+// time of clustering fewer representatives is too short to extrapolate from
+#define APPROX_MIN_ESTIMATE_COUNT 64
+
+// returns estimated time of exact clustering from time of clustering representatives,
+// reference engine grows with cube of count (ranges of all pairs are merged on every
+// merge), the others with square of it
+double estimateExactSeconds(double seconds, int count, int representativeCount, int engine)
+{
+    double ratio = (double)count/representativeCount;
+    return engine == referenceEngine ? seconds*ratio*ratio*ratio : seconds*ratio*ratio;
+}
+
+// clusters flows approximately: flows are collapsed to representatives of grid cells,
+// representatives are clustered exactly by engine from options and every flow is then
+// given to cluster of its representative, storage is replaced with result,
+// returns 1 if allocation failed, 2 if EPS is too small for features and 3 if it is
+// so big that there are fewer representatives than wanted clusters
+int approximateClusters(int destClusterCount, ClusterStorage* storage, Weights weights, Options options)
 {
-    // create array for storing flows by flowCounts from both clusters
-    Flow flows[clusterA.flowCount + clusterB.flowCount];
+    int count = storage->clusterCount;
+    double startTime = currentSeconds();
+    if (destClusterCount > count)
+    {
+        return 1;
+    }
+
+    Coreset coreset;
+    int result = buildCoreset(storage, weights, options.approxEps, &coreset);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    // representatives are first flows of their cells, input index leads back to their cell
+    ClusterStorage representatives;
+    representatives.clusterCount = 0;
+    representatives.clusters = malloc(sizeof(Cluster)*coreset.cellCount);
+    int* cellOfInput = malloc(sizeof(int)*count);
+    if (representatives.clusters == NULL || cellOfInput == NULL)
+    {
+        free(representatives.clusters);
+        free(cellOfInput);
+        freeCoreset(&coreset);
+        return 1;
+    }
+    for (int c = 0; c < coreset.cellCount; c++)
+    {
+        Flow representative = storage->clusters[coreset.cellFirst[c]].flows[0];
+        cellOfInput[representative.inputInx] = c;
+        representatives.clusters[c] = initCluster(&representative, 1);
+        if (representatives.clusters[c].flowCount == -1)
+        {
+            freeAll(&representatives, 0);
+            free(cellOfInput);
+            freeCoreset(&coreset);
+            return 1;
+        }
+        representatives.clusterCount++;
+    }
+    double coresetTime = currentSeconds();
+
+    // representatives are clustered exactly, there can not be more clusters than them
+    if (destClusterCount > coreset.cellCount)
+    {
+        fprintf(stderr, "Approx: %i representatives, fewer than %i wanted clusters\n", coreset.cellCount,
+            destClusterCount);
+        freeAll(&representatives, 0);
+        free(cellOfInput);
+        freeCoreset(&coreset);
+        return 3;
+    }
+    if (clusterToNGroups(destClusterCount, &representatives, weights, options) != 0)
+    {
+        freeAll(&representatives, 1);
+        free(cellOfInput);
+        freeCoreset(&coreset);
+        return 1;
+    }
+    double clusteringTime = currentSeconds();
+
+    // cluster of every cell is found from its representative
+    int* clusterOfCell = malloc(sizeof(int)*coreset.cellCount);
+    int* clusterStart = calloc(representatives.clusterCount + 1, sizeof(int));
+    Flow* flowBuffer = malloc(sizeof(Flow)*count);
+    Cluster* clusters = malloc(sizeof(Cluster)*representatives.clusterCount);
+    if (clusterOfCell == NULL || clusterStart == NULL || flowBuffer == NULL || clusters == NULL)
+    {
+        free(clusterOfCell);
+        free(clusterStart);
+        free(flowBuffer);
+        free(clusters);
+        freeAll(&representatives, 1);
+        free(cellOfInput);
+        freeCoreset(&coreset);
+        return 1;
+    }
+    for (int n = 0; n < representatives.clusterCount; n++)
+    {
+        for (int i = 0; i < representatives.clusters[n].flowCount; i++)
+        {
+            int cell = cellOfInput[representatives.clusters[n].flows[i].inputInx];
+            clusterOfCell[cell] = n;
+            clusterStart[n + 1] += coreset.cellSize[cell];
+        }
+    }
+    for (int n = 0; n < representatives.clusterCount; n++)
+    {
+        clusterStart[n + 1] += clusterStart[n];
+    }
+
+    // one pass over all flows places them to clusters of their representatives,
+    // the farthest flow from its representative is measured error of approximation
+    double maxError = 0;
+    for (int i = 0; i < count; i++)
+    {
+        int cell = coreset.cellOf[i];
+        int n = clusterOfCell[cell];
+        Flow representative = storage->clusters[coreset.cellFirst[cell]].flows[0];
+        for (int f = 0; f < storage->clusters[i].flowCount; f++)
+        {
+            double error = findRange(storage->clusters[i].flows[f], representative, weights);
+            maxError = error > maxError ? error : maxError;
+            flowBuffer[clusterStart[n]] = storage->clusters[i].flows[f];
+            clusterStart[n]++;
+        }
+    }
 
-    // placing all flows from clusterA to united flow array
-    for (int i = 0; i < clusterA.flowCount; i++)
+    // starts were moved to ends of clusters by filling
+    int clusterCount = 0;
+    for (int n = 0; n < representatives.clusterCount; n++)
     {
-        flows[i] = clusterA.flows[i];
+        int begin = n > 0 ? clusterStart[n-1] : 0;
+        clusters[n] = initCluster(&flowBuffer[begin], clusterStart[n] - begin);
+        if (clusters[n].flowCount == -1)
+        {
+            result = 1;
+            break;
+        }
+        if (clusters[n].stats != NULL)
+        {
+            clusters[n].stats->mergeHeight = representatives.clusters[n].stats->mergeHeight;
+        }
+        clusterCount++;
+    }
+    double endTime = currentSeconds();
+
+    if (result == 0)
+    {
+        double exactSeconds = estimateExactSeconds(clusteringTime - coresetTime, countDistinctFlows(storage),
+            coreset.cellCount, options.engine);
+        fprintf(stderr, "Approx: %i flows, %i representatives (cell side %g)\n", count, coreset.cellCount,
+            options.approxEps/2);
+        fprintf(stderr, "Approx: max distance of flow to representative %g (guaranteed at most %g), "
+            "merge distances differ from exact ones by at most %g\n", maxError, options.approxEps, 2*maxError);
+        fprintf(stderr, "Approx: coreset %.6f s, clustering %.6f s, assignment %.6f s\n", coresetTime - startTime,
+            clusteringTime - coresetTime, endTime - clusteringTime);
+
+        // exact run is not measured, its time is extrapolated from clustering of representatives,
+        // which says nothing if there are only few of them
+        if (coreset.cellCount >= APPROX_MIN_ESTIMATE_COUNT)
+        {
+            fprintf(stderr, "Approx: exact clustering estimated (extrapolated, not measured) at %.6f s, "
+                "estimated speedup %.1f\n", exactSeconds,
+                endTime > startTime ? exactSeconds/(endTime - startTime) : 0);
+        }
+        else
+        {
+            fprintf(stderr, "Approx: exact clustering not estimated, %i representatives are too few "
+                "to extrapolate from\n", coreset.cellCount);
+        }
+
+        // replaces original clusters with approximate ones
+        freeAll(storage, 0);
+        storage->clusters = clusters;
+        storage->clusterCount = clusterCount;
+        sortClustersByID(storage->clusters, storage->clusterCount);
     }
-    // placing all flows from clusterB to united flow array
-    for (int i = 0; i < clusterB.flowCount; i++)
+    else
     {
-        flows[i+clusterA.flowCount] = clusterB.flows[i];
+        prepareClusterArrForDeletion(clusters, clusterCount);
+        free(clusters);
     }
-    return initCluster(flows, clusterA.flowCount + clusterB.flowCount);
+
+    free(clusterOfCell);
+    free(clusterStart);
+    free(flowBuffer);
+    freeAll(&representatives, 1);
+    free(cellOfInput);
+    freeCoreset(&coreset);
+    return result;
 }
 
-// prepares cluster for delete
-void prepareForDelete(Cluster* cluster, bool rangesCalculated)
+// Functions for streaming summarization
+// -------------------------------------------------------------------------------------
+
+#define SUMMARY_CAPACITY 16
+
+// structure for storing summary of flows: their count, sums of features relative
+// to origin of tree and weighted sum of squares of these features
+typedef struct SFeatureSummary
 {
-    // frees flow array of cluster
-    free(cluster->flows);
+    long count;
+    double sums[4];
+    double squareSum;
+    int firstID;
+}FeatureSummary;
 
-    // replaces pointer with NULL
-    cluster->flows = NULL;
+// structure for storing node of summary tree, entries of inner nodes summarize their children
+typedef struct SSummaryNode
+{
+    bool isLeaf;
+    int entryCount;
+    // one more place for entry which is split off at once
+    FeatureSummary entries[SUMMARY_CAPACITY + 1];
+    struct SSummaryNode* children[SUMMARY_CAPACITY + 1];
+}SummaryNode;
 
-    // marks cluster as empty changing its flowCount with -1
-    cluster->flowCount = -1;
+// structure for storing summary of stream, its nodes never take more than memory limit
+typedef struct SSummaryTree
+{
+    SummaryNode* root;
+    Weights weights;
+    double origin[4];
+    // the biggest radius of leaf entry which can absorb flow
+    double threshold;
+    long nodeCount;
+    long maxNodeCount;
+    long memoryLimit;
+    long leafEntryCount;
+    long flowCount;
+    long skippedCount;
+    int rebuildCount;
+}SummaryTree;
 
-    //if ranges were calculated, free range array
-    if (rangesCalculated)
+// structure for reading lines from file descriptor, reading can be interrupted by signal
+typedef struct SStreamReader
+{
+    int fd;
+    char buffer[1 << 16];
+    size_t begin;
+    size_t end;
+    bool isAtEnd;
+}StreamReader;
+
+// sorts summaries of clusters by their first flowID
+int compareSummariesID(const void* a, const void* b)
+{
+    int arg1 = ((const FeatureSummary*)a)->firstID;
+    int arg2 = ((const FeatureSummary*)b)->firstID;
+    return (arg1 > arg2) - (arg1 < arg2);
+}
+
+// set by SIGUSR1, clusters of summary are printed as soon as reading is interrupted
+volatile sig_atomic_t isSummaryRequested = 0;
+
+void requestSummary(int signalNumber)
+{
+    (void)signalNumber;
+    isSummaryRequested = 1;
+}
+
+// returns summary of one flow
+FeatureSummary initSummary(SummaryTree* tree, Flow flow)
+{
+    FeatureSummary summary;
+    summary.count = 1;
+    summary.squareSum = 0;
+    for (int k = 0; k < 4; k++)
     {
-        free(cluster->ranges);
-        cluster->ranges = NULL;
+        summary.sums[k] = getFeature(flow, k) - tree->origin[k];
+        summary.squareSum += getWeight(tree->weights, k)*summary.sums[k]*summary.sums[k];
     }
+    summary.firstID = flow.flowID;
+    return summary;
 }
 
-// unites 2 clusters and deletes originals
-int uniteAndDelete(ClusterStorage* storage, Cluster *clusterA, Cluster *clusterB)
+// returns summary of flows of 2 summaries
+FeatureSummary addSummaries(FeatureSummary a, FeatureSummary b)
 {
-    // call function which creates united cluster
-    Cluster unitedCluster = uniteClusters(*clusterA, *clusterB);
+    FeatureSummary summary;
+    summary.count = a.count + b.count;
+    for (int k = 0; k < 4; k++)
+    {
+        summary.sums[k] = a.sums[k] + b.sums[k];
+    }
+    summary.squareSum = a.squareSum + b.squareSum;
+    summary.firstID = a.firstID < b.firstID ? a.firstID : b.firstID;
+    return summary;
+}
 
-    // if united cluster is marked with -1 - break
-    if (unitedCluster.flowCount == -1)
+// returns weighted range between centroids of 2 summaries
+double summaryRange(SummaryTree* tree, FeatureSummary a, FeatureSummary b)
+{
+    double sum = 0;
+    for (int k = 0; k < 4; k++)
     {
-        return 1;
+        sum += getWeight(tree->weights, k)*squareFloat(a.sums[k]/a.count - b.sums[k]/b.count);
     }
+    return sqrt(sum);
+}
 
-    // if error appeared while uniting ranges - break
-    if (uniteRangesInClusters(clusterA, clusterB, &unitedCluster) == 1)
+// returns weighted radius of summary (root mean square range of its flows from centroid)
+double summaryRadius(SummaryTree* tree, FeatureSummary summary)
+{
+    double centroidSquare = 0;
+    for (int k = 0; k < 4; k++)
+    {
+        centroidSquare += getWeight(tree->weights, k)*squareFloat(summary.sums[k]/summary.count);
+    }
+    // overflowed sums give variance which is not a number, such entry absorbs nothing
+    double variance = summary.squareSum/summary.count - centroidSquare;
+    if (isnan(variance))
+    {
+        return INFINITY;
+    }
+    return variance > 0 ? sqrt(variance) : 0;
+}
+
+// returns new empty node of tree, or NULL if allocation failed
+SummaryNode* newSummaryNode(SummaryTree* tree, bool isLeaf)
+{
+    SummaryNode* node = malloc(sizeof(SummaryNode));
+    if (node != NULL)
+    {
+        node->isLeaf = isLeaf;
+        node->entryCount = 0;
+        tree->nodeCount++;
+    }
+    return node;
+}
+
+void freeSummaryNode(SummaryNode* node)
+{
+    if (node == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < node->entryCount && !node->isLeaf; i++)
+    {
+        freeSummaryNode(node->children[i]);
+    }
+    free(node);
+}
+
+// returns summary of all entries of node
+FeatureSummary summaryOfNode(SummaryNode* node)
+{
+    FeatureSummary summary = node->entries[0];
+    for (int i = 1; i < node->entryCount; i++)
+    {
+        summary = addSummaries(summary, node->entries[i]);
+    }
+    return summary;
+}
+
+// splits overfull node, the farthest pair of entries are seeds of node and its new sibling
+// and every other entry goes to the closer one, returns 1 if allocation failed
+int splitSummaryNode(SummaryTree* tree, SummaryNode* node, SummaryNode** sibling)
+{
+    *sibling = newSummaryNode(tree, node->isLeaf);
+    if (*sibling == NULL)
     {
         return 1;
     }
 
-    // prepares united clusters for deletion
-    prepareForDelete(clusterA, 1);
-    prepareForDelete(clusterB, 1);
+    int seedA = 0;
+    int seedB = 1;
+    double farthest = -1;
+    for (int i = 0; i < node->entryCount; i++)
+    {
+        for (int j = i + 1; j < node->entryCount; j++)
+        {
+            double range = summaryRange(tree, node->entries[i], node->entries[j]);
+            if (range > farthest)
+            {
+                farthest = range;
+                seedA = i;
+                seedB = j;
+            }
+        }
+    }
 
-    // sorting clusters by flowCount from biggest to smallest,
-    // so empty clusters marked with flowCount -1 will be in the end
-    sortClustersFlowCount(storage->clusters, storage->clusterCount);
+    FeatureSummary entries[SUMMARY_CAPACITY + 1];
+    SummaryNode* children[SUMMARY_CAPACITY + 1];
+    int entryCount = node->entryCount;
+    memcpy(entries, node->entries, sizeof(FeatureSummary)*entryCount);
+    memcpy(children, node->children, sizeof(SummaryNode*)*entryCount);
+    node->entryCount = 0;
+    for (int i = 0; i < entryCount; i++)
+    {
+        bool isCloserToB = i == seedB || (i != seedA &&
+            summaryRange(tree, entries[i], entries[seedB]) < summaryRange(tree, entries[i], entries[seedA]));
+        SummaryNode* target = isCloserToB ? *sibling : node;
+        target->entries[target->entryCount] = entries[i];
+        target->children[target->entryCount] = children[i];
+        target->entryCount++;
+    }
+    return 0;
+}
 
-    // update clusterCount
-    (storage->clusterCount)--;
+// inserts summary to subtree of node, it is absorbed by the closest leaf entry if their
+// radius stays within threshold, if node overflows its new sibling is returned in split,
+// returns 1 if allocation failed
+int insertSummary(SummaryTree* tree, SummaryNode* node, FeatureSummary summary, SummaryNode** split)
+{
+    *split = NULL;
+    int closest = -1;
+    double closestRange = INFINITY;
+    for (int i = 0; i < node->entryCount; i++)
+    {
+        double range = summaryRange(tree, node->entries[i], summary);
+        if (range < closestRange)
+        {
+            closestRange = range;
+            closest = i;
+        }
+    }
 
-    // append united cluster to end of array
-    storage->clusters[(storage->clusterCount)-1] = unitedCluster;
+    if (node->isLeaf)
+    {
+        if (closest >= 0)
+        {
+            FeatureSummary merged = addSummaries(node->entries[closest], summary);
+            if (summaryRadius(tree, merged) <= tree->threshold)
+            {
+                node->entries[closest] = merged;
+                return 0;
+            }
+        }
+        node->entries[node->entryCount] = summary;
+        node->children[node->entryCount] = NULL;
+        node->entryCount++;
+        tree->leafEntryCount++;
+    }
+    else
+    {
+        // every range can be not a number only if summary is, then it goes to first child
+        closest = closest >= 0 ? closest : 0;
+        SummaryNode* childSplit;
+        if (insertSummary(tree, node->children[closest], summary, &childSplit) != 0)
+        {
+            return 1;
+        }
+        if (childSplit == NULL)
+        {
+            node->entries[closest] = addSummaries(node->entries[closest], summary);
+            return 0;
+        }
+        node->entries[closest] = summaryOfNode(node->children[closest]);
+        node->entries[node->entryCount] = summaryOfNode(childSplit);
+        node->children[node->entryCount] = childSplit;
+        node->entryCount++;
+    }
+
+    if (node->entryCount > SUMMARY_CAPACITY)
+    {
+        return splitSummaryNode(tree, node, split);
+    }
+    return 0;
+}
+
+// inserts summary to tree, root is split to 2 new children if it overflows,
+// returns 1 if allocation failed
+int insertToSummaryTree(SummaryTree* tree, FeatureSummary summary)
+{
+    SummaryNode* split;
+    if (insertSummary(tree, tree->root, summary, &split) != 0)
+    {
+        return 1;
+    }
+    if (split != NULL)
+    {
+        SummaryNode* root = newSummaryNode(tree, false);
+        if (root == NULL)
+        {
+            freeSummaryNode(split);
+            return 1;
+        }
+        root->entries[0] = summaryOfNode(tree->root);
+        root->children[0] = tree->root;
+        root->entries[1] = summaryOfNode(split);
+        root->children[1] = split;
+        root->entryCount = 2;
+        tree->root = root;
+    }
+    return 0;
+}
+
+// copies entries of all leaves to array and finds the smallest radius which would
+// merge 2 entries of some leaf
+void collectLeafEntries(SummaryTree* tree, SummaryNode* node, FeatureSummary* entries, long* count,
+    double* smallestRadius)
+{
+    if (!node->isLeaf)
+    {
+        for (int i = 0; i < node->entryCount; i++)
+        {
+            collectLeafEntries(tree, node->children[i], entries, count, smallestRadius);
+        }
+        return;
+    }
+    for (int i = 0; i < node->entryCount; i++)
+    {
+        entries[*count] = node->entries[i];
+        (*count)++;
+        for (int j = i + 1; j < node->entryCount; j++)
+        {
+            double radius = summaryRadius(tree, addSummaries(node->entries[i], node->entries[j]));
+            *smallestRadius = radius < *smallestRadius ? radius : *smallestRadius;
+        }
+    }
+}
+
+// rebuilds tree with bigger threshold until it fits into memory limit, leaf entries
+// are inserted again and close ones are absorbed, returns 1 if allocation failed
+int rebuildSummaryTree(SummaryTree* tree)
+{
+    while (tree->nodeCount > tree->maxNodeCount)
+    {
+        FeatureSummary* entries = malloc(sizeof(FeatureSummary)*tree->leafEntryCount);
+        if (entries == NULL)
+        {
+            return 1;
+        }
+        long entryCount = 0;
+        double smallestRadius = INFINITY;
+        collectLeafEntries(tree, tree->root, entries, &entryCount, &smallestRadius);
+
+        // threshold at least doubles, and it is big enough for at least one merge
+        double threshold = 2*tree->threshold > smallestRadius ? 2*tree->threshold : smallestRadius;
+        freeSummaryNode(tree->root);
+        tree->nodeCount = 0;
+        tree->leafEntryCount = 0;
+        tree->threshold = threshold;
+        tree->rebuildCount++;
+        tree->root = newSummaryNode(tree, true);
+        int result = tree->root == NULL;
+        for (long i = 0; i < entryCount && result == 0; i++)
+        {
+            result = insertToSummaryTree(tree, entries[i]);
+        }
+        free(entries);
+        if (result != 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
 
-    // realloc to new address
-    Cluster *tmp = realloc(storage->clusters, sizeof(Cluster)*storage->clusterCount);
-    // unsuccessful allocation check
-    if (tmp == NULL)
+// parses flow record in same format as lines of input file, returns 1 if it is wrong
+int parseFlowLine(const char* line, int inputInx, Flow* flow)
+{
+    int flowID;
+    int ip[8];
+    int totalBytes;
+    int flowDuration;
+    int packetCount;
+    double avgInterarrivalTime;
+    int readCount = 0;
+    if (sscanf(line, "%i %i.%i.%i.%i %i.%i.%i.%i %i %i %i %lf %n", &flowID, &ip[0], &ip[1], &ip[2], &ip[3],
+            &ip[4], &ip[5], &ip[6], &ip[7], &totalBytes, &flowDuration, &packetCount,
+            &avgInterarrivalTime, &readCount) != 13 || line[readCount] != '\0' || flowID < 0)
     {
-        fprintf(stderr, "ERROR alloc failed\n");
         return 1;
     }
-    else
+
+    // addresses are only checked, summary does not use them
+    for (int i = 0; i < 8; i++)
     {
-        storage->clusters = tmp;
+        if (!(ip[i] >= 0 && ip[i] < 256))
+        {
+            return 1;
+        }
     }
-    return 0;
-}
 
-// finds range between 2 netDots
-double findRange(Flow flowA, Flow flowB, Weights weights)
-{
-    return sqrt(
-    weights.bytes*squareInt(flowA.totalBytes - flowB.totalBytes) +
-    weights.duration*squareInt(flowA.flowDuration - flowB.flowDuration) +
-    weights.interTime*squareFloat(flowA.avgInterTime - flowB.avgInterTime) +
-    weights.interLength* squareFloat(flowA.avgInterLength - flowB.avgInterLength)
-    );
+    // summaries of infinite features are not numbers, so they would spoil whole tree
+    *flow = initFlow(flowID, inputInx, totalBytes, flowDuration, packetCount, avgInterarrivalTime);
+    for (int k = 0; k < 4; k++)
+    {
+        if (!isfinite(getFeature(*flow, k)))
+        {
+            return 1;
+        }
+    }
+    return 0;
 }
 
-// calculates and records ranges to dedicated structures for all clusters in given storage
-int calculateAndRecordRanges(ClusterStorage* storage, Weights weights)
+// reads one line from file descriptor to line without new line character,
+// returns 1 for line, 0 at end of input and -1 if reading was interrupted by signal
+int readStreamLine(StreamReader* reader, char* line, size_t lineSize)
 {
-    for (int i = 0; i < storage->clusterCount; i++)
+    while (true)
     {
-        storage->clusters[i].rangeCount = storage->clusterCount-1;
-
-        // allocating tmp range array
-        Range* tmp = malloc(sizeof(Range)*(storage->clusterCount-1));
-
-        // allocation check
-        if (tmp == NULL)
+        char* end = memchr(reader->buffer + reader->begin, '\n', reader->end - reader->begin);
+        if (end != NULL || (reader->isAtEnd && reader->end > reader->begin))
         {
+            size_t length = end != NULL ? (size_t)(end - (reader->buffer + reader->begin)) : reader->end - reader->begin;
+            size_t copied = length < lineSize - 1 ? length : lineSize - 1;
+            memcpy(line, reader->buffer + reader->begin, copied);
+            line[copied] = '\0';
+            reader->begin += length + (end != NULL);
             return 1;
         }
+        if (reader->isAtEnd)
+        {
+            return 0;
+        }
 
-        // introducing tmp variable
-        int writtenCount = 0;
-        for (int n = 0; n < storage->clusterCount; n++)
+        // unfinished line is moved to start of buffer, too long lines are cut
+        if (reader->begin > 0)
+        {
+            memmove(reader->buffer, reader->buffer + reader->begin, reader->end - reader->begin);
+            reader->end -= reader->begin;
+            reader->begin = 0;
+        }
+        if (reader->end == sizeof(reader->buffer))
+        {
+            reader->end = lineSize;
+        }
+        ssize_t readCount = read(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end);
+        if (readCount < 0)
         {
-            // we don't calculate range to self (it's pretty senseless)
-            if (n == i)
+            if (errno == EINTR)
             {
-                continue;
+                return -1;
             }
-            tmp[writtenCount] = initRange(storage->clusters[n].flows[0].flowID,
-                findRange(storage->clusters[n].flows[0], storage->clusters[i].flows[0], weights));
-            writtenCount++;
+            reader->isAtEnd = true;
+        }
+        else if (readCount == 0)
+        {
+            reader->isAtEnd = true;
+        }
+        else
+        {
+            reader->end += (size_t)readCount;
         }
-
-        //recording it to cluster itself
-        storage->clusters[i].ranges = tmp;
-
-        //sorting ranges inside cluster
-        sortRangesInCluster(&storage->clusters[i]);
     }
-    return 0;
 }
 
-// finds closest pair of clusters and returns array with united cluster
-int findClosestAndUnite(ClusterStorage* storage)
+// clusters leaf entries of tree to wanted count by engine from options and prints
+// count, first flowID, centroid and radius of every cluster, returns 1 if allocation failed
+int summaryClustersOut(FILE* out, SummaryTree* tree, int destClusterCount, Options options)
 {
-    // sorting all clusters by shortest range so first 2 will be the nearest pair
-    sortClustersByRange(storage);
-
-    // unites found pair and appends it to cluster storage, and checks, if everything is ok
-    if (uniteAndDelete(storage, &storage->clusters[0], &storage->clusters[1]) != 0)
+    long entryCount = 0;
+    double smallestRadius = INFINITY;
+    FeatureSummary* entries = malloc(sizeof(FeatureSummary)*(tree->leafEntryCount + 1));
+    ClusterStorage storage;
+    storage.clusterCount = 0;
+    storage.clusters = malloc(sizeof(Cluster)*(tree->leafEntryCount + 1));
+    if (entries == NULL || storage.clusters == NULL)
     {
+        free(entries);
+        free(storage.clusters);
         return 1;
     }
-    return 0;
-}
+    collectLeafEntries(tree, tree->root, entries, &entryCount, &smallestRadius);
 
-// finds and unites clusters until their number reaches wanted count
-int uniteToNGroups(int destClusterCount, ClusterStorage* storage, Weights weights)
-{
-    // checking if destination cluster count is smaller or equal too actual cluster count
-    if (destClusterCount > storage->clusterCount)
+    // every entry is one flow placed at its centroid, input index leads back to entry
+    for (long i = 0; i < entryCount; i++)
+    {
+        double centroid[4];
+        for (int k = 0; k < 4; k++)
+        {
+            centroid[k] = tree->origin[k] + entries[i].sums[k]/entries[i].count;
+        }
+        Flow flow = initFlow((int)i, (int)i, (int)lround(centroid[0]), (int)lround(centroid[1]), 1, centroid[2]);
+        flow.avgInterLength = centroid[3];
+        storage.clusters[i] = initCluster(&flow, 1);
+        if (storage.clusters[i].flowCount == -1)
+        {
+            freeAll(&storage, 0);
+            free(entries);
+            return 1;
+        }
+        storage.clusterCount++;
+    }
+
+    // reference engine keeps ranges of all pairs, which would break memory limit
+    if (options.engine == referenceEngine)
+    {
+        options.engine = spanningTreeEngine;
+    }
+    int dest = destClusterCount < storage.clusterCount ? destClusterCount : storage.clusterCount;
+    if (storage.clusterCount > 0 && clusterToNGroups(dest, &storage, tree->weights, options) != 0)
     {
-        finishProgram(afterRead, 0, 0, storage, 0);
+        freeAll(&storage, 1);
+        free(entries);
         return 1;
     }
-    // in case we need only to write sorted clusters, we only sort clusters by flowID
-    if (destClusterCount == -1)
+
+    // summaries of clusters are sums of summaries of their entries
+    FeatureSummary* clusters = malloc(sizeof(FeatureSummary)*(storage.clusterCount + 1));
+    if (clusters == NULL)
     {
-        // sorts clusters in storage
-        sortClustersByID(storage->clusters, storage->clusterCount);
-        return 0;
+        freeAll(&storage, 1);
+        free(entries);
+        return 1;
     }
-    // if start count of clusters and destinations ones are not same
-    // starts cycle which finds and unites cluster
-    // to the point when destination is reached
-    if (destClusterCount != storage->clusterCount)
+    for (int n = 0; n < storage.clusterCount; n++)
     {
-        if (calculateAndRecordRanges(storage, weights) == 1)
+        clusters[n] = entries[storage.clusters[n].flows[0].inputInx];
+        for (int i = 1; i < storage.clusters[n].flowCount; i++)
         {
-            return 1;
+            clusters[n] = addSummaries(clusters[n], entries[storage.clusters[n].flows[i].inputInx]);
         }
-        do
+    }
+    qsort(clusters, storage.clusterCount, sizeof(FeatureSummary), compareSummariesID);
+
+    fprintf(out, "Summary: %li flows, %li leaf entries, %li nodes (%li bytes of %li), threshold %g, "
+        "rebuilds %i, skipped records %li\n", tree->flowCount, tree->leafEntryCount, tree->nodeCount,
+        tree->nodeCount*(long)sizeof(SummaryNode), tree->memoryLimit, tree->threshold, tree->rebuildCount,
+        tree->skippedCount);
+    fprintf(out, "Clusters:\n");
+    for (int n = 0; n < storage.clusterCount; n++)
+    {
+        fprintf(out, "cluster %i: count %li, first %i, centroid", n, clusters[n].count, clusters[n].firstID);
+        for (int k = 0; k < 4; k++)
         {
-            if (findClosestAndUnite(storage) != 0)
-            {
-                return 1;
-            }
-            // printf("%i\n", storage->clusterCount);
+            fprintf(out, "%c%g", k == 0 ? ' ' : '/', tree->origin[k] + clusters[n].sums[k]/clusters[n].count);
         }
-        while (destClusterCount != storage->clusterCount);
+        fprintf(out, ", radius %g\n", summaryRadius(tree, clusters[n]));
     }
+    fflush(out);
 
-    // sorts clusters in storage
-    sortClustersByID(storage->clusters, storage->clusterCount);
+    free(clusters);
+    freeAll(&storage, 1);
+    free(entries);
     return 0;
 }
 
-// prints info about exact cluster
-void clusterOut(Cluster cluster, int clusterInx)
+// reads flows from stdin without count until its end and keeps only their summary
+// in tree which fits into memory limit, clusters of summary are printed at the end
+// and every time program gets SIGUSR1
+int runStreamMode(int argc, char* argv[], Options options)
 {
-    printf("cluster %i: ", clusterInx);
-
-    for (int i = 0; i < cluster.flowCount; i++)
+    SummaryTree tree;
+    int destClusterCount;
+    // memory limit has to hold at least root of tree, summary can not be exported
+    if (collectInfoFromInput(argc, argv, &tree.weights, &destClusterCount) == 1 || destClusterCount <= 0 ||
+        options.memoryLimit < (long)sizeof(SummaryNode) || options.exportPath != NULL)
     {
-        printf("%i ", cluster.flows[i].flowID);
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        return 1;
     }
-    printf("\n");
-}
-
-// prints info about all clusters
-void infoOut(ClusterStorage storage)
-{
-    printf("Clusters:\n");
 
-    for (int i = 0; i < storage.clusterCount; i++)
+    tree.memoryLimit = options.memoryLimit;
+    tree.maxNodeCount = options.memoryLimit/(long)sizeof(SummaryNode);
+    tree.nodeCount = 0;
+    tree.leafEntryCount = 0;
+    tree.flowCount = 0;
+    tree.skippedCount = 0;
+    tree.threshold = 0;
+    tree.rebuildCount = 0;
+    tree.root = newSummaryNode(&tree, true);
+    StreamReader* reader = malloc(sizeof(StreamReader));
+    if (tree.root == NULL || reader == NULL)
     {
-        clusterOut(storage.clusters[i], i);
+        free(tree.root);
+        free(reader);
+        fprintf(stderr, "ERROR: Some allocation failed\n");
+        return 1;
     }
-}
+    reader->fd = STDIN_FILENO;
+    reader->begin = 0;
+    reader->end = 0;
+    reader->isAtEnd = false;
 
-// controlls if IP is relevant
-int controlIP(FILE* srcFile)
-{
-    int tmpIP[4];
+    // reading is not restarted after signal, so summary is printed even if input is idle
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestSummary;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR1, &action, NULL);
 
-    for (int i = 0; i < 2; i++)
+    int result = 0;
+    char line[512];
+    while (result == 0)
     {
-        if (fscanf(srcFile, "%i.%i.%i.%i ", &tmpIP[0], &tmpIP[1], &tmpIP[2], &tmpIP[3]) != 4)
-            return 1;
+        int lineResult = readStreamLine(reader, line, sizeof(line));
+        if (isSummaryRequested)
+        {
+            isSummaryRequested = 0;
+            result = summaryClustersOut(stdout, &tree, destClusterCount, options);
+        }
+        if (lineResult == 0)
+        {
+            break;
+        }
+        if (lineResult < 0 || line[strspn(line, " \t\r")] == '\0')
+        {
+            continue;
+        }
 
-        for (int n = 0; n < 4; n++)
+        // features are summed relative to the first flow, so sums of squares stay small
+        Flow flow;
+        if (parseFlowLine(line, 0, &flow) != 0)
         {
-            if (!(tmpIP[n] >= 0 && tmpIP[n] < 256))
-                return 1;
+            tree.skippedCount++;
+            continue;
+        }
+        if (tree.flowCount == 0)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                tree.origin[k] = getFeature(flow, k);
+            }
+        }
+        tree.flowCount++;
+        result = insertToSummaryTree(&tree, initSummary(&tree, flow));
+        if (result == 0 && tree.nodeCount > tree.maxNodeCount)
+        {
+            result = rebuildSummaryTree(&tree);
         }
     }
-    return 0;
-}
 
-// prepares clusterArr for deletion
-void prepareClusterArrForDeletion(Cluster *clusterArr, int allocClustersCount)
-{
-    for (int j = 0; j < allocClustersCount; j++)
+    if (result == 0)
     {
-        prepareForDelete(&clusterArr[j], 0);
+        result = summaryClustersOut(stdout, &tree, destClusterCount, options);
+    }
+    if (result != 0)
+    {
+        fprintf(stderr, "ERROR: Some allocation failed\n");
     }
+    freeSummaryNode(tree.root);
+    free(reader);
+    return result;
 }
 
-int collectInfoFromInput(int argc, char* argv[], Weights* weights, int* destClusterCount)
+// clusters flows of one file and prints result
+int runClusteringMode(int argc, char* argv[], Options options)
 {
-    // check if argument number is correct, if not stops program with error
-    if (argc != 7)
+    // weights are taken from file instead of arguments
+    if (options.weightsFile != NULL)
     {
-        //if we have only filename entered we mark it by unreal destClusterCount
-        if (argc == 2)
+        if (options.exportPath != NULL || options.partitionBy != noPartition || options.windowSize > 0 ||
+            options.approxEps > 0)
         {
-            *destClusterCount = -1;
-            return 0;
+            finishProgram(inputProcessing, 1, 0, 0, 0);
+            return 1;
         }
-        return 1;
+        return runWeightSweep(argc, argv, options);
     }
 
-    *destClusterCount = atoi(argv[2]);
-
+    // inits weights united storage
+    Weights weights;
 
-    // stores all given data in weights united storage
-    char *endptr;
-    weights->bytes = strtod(argv[3], &endptr);
-    weights->duration = strtod(argv[4], &endptr);
-    weights->interTime = strtod(argv[5], &endptr);
-    weights->interLength = strtod(argv[6], &endptr);
+    // stores destination cluster count
+    int destClusterCount;
 
-    // weights control
-    if (weights->bytes < 0 ||
-        weights->duration < 0 ||
-        weights->interTime < 0 ||
-        weights->interLength < 0)
+    if (collectInfoFromInput(argc, argv, &weights, &destClusterCount) == 1)
     {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
         return 1;
     }
 
-    // verifies if destination cluster count is legit
-    if (*destClusterCount <= 0)
+    // forms cluster storage from source file, addresses are needed only by partitions
+    ClusterStorage clusterStorage;
+    uint32_t* addresses = NULL;
+
+    if (loadStorageFromFile(argv[1], &clusterStorage, options.partitionBy != noPartition ? &addresses : NULL) != 0)
     {
         return 1;
     }
-    return 0;
-}
-
-// creates cluster from source file
-int collectInfoFromSourceFile(FILE* srcFile, ClusterStorage *clusterStorage)
-{
-    // init all essential variables for temporary storing data
-    int currClusterCount;
-    int flowID;
-    int totalBytes;
-    int flowDuration;
-    int packetCount;
-    double avgInterarrivalTime;
 
-    // finds start cluster count
-    if (fscanf(srcFile, "count=%i\n", &currClusterCount) != 1)
+    // export is written only for exact clusters of whole file, approximation works only with whole file
+    bool isWholeFile = options.partitionBy == noPartition && options.windowSize == 0;
+    bool isExportWrong = options.exportPath != NULL && (!isWholeFile || options.approxEps > 0);
+    if (isExportWrong || (options.approxEps > 0 && !isWholeFile))
     {
+        finishProgram(inputProcessing, 1, 0, 0, 0);
+        finishProgram(afterRead, 0, 0, &clusterStorage, 0);
+        free(addresses);
         return 1;
     }
 
-    // init tmp cluster storage
-    Cluster tmpClusterArr[currClusterCount];
+    // partitions are clustered and printed one by one
+    if (options.partitionBy != noPartition)
+    {
+        int result = uniteInPartitions(stdout, destClusterCount, &clusterStorage, addresses, weights, options);
+        finishProgram(afterRead, result, 0, &clusterStorage, 1);
+        free(addresses);
+        return result;
+    }
 
-    // all clusters in start have only 1 flow, but intCluster function requires array,
-    // so we just sore single number in array form
-    Flow flows[1];
+    // windows are clustered and printed one by one
+    if (options.windowSize > 0)
+    {
+        int result = uniteInWindows(stdout, destClusterCount, &clusterStorage, weights, options);
+        finishProgram(afterRead, result, 0, &clusterStorage, 0);
+        return result;
+    }
 
-    // traverses left source file lines scanning every line
-    // and storing important info to tmp variables
-    for (int i = 0; i < currClusterCount; i++)
+    // every merge unites 2 clusters, so there are fewer merges than flows
+    if (options.exportPath != NULL && options.exportMerges)
     {
-        if (fscanf(srcFile, "%i ", &flowID) != 1 || flowID < 0 || controlIP(srcFile) == 1 ||
-            fscanf(srcFile, "%i %i %i %lf\n", &totalBytes, &flowDuration, &packetCount, &avgInterarrivalTime) != 4)
+        mergeLog.merges = malloc(sizeof(FlowsExportMerge)*clusterStorage.clusterCount);
+        mergeLog.capacity = mergeLog.merges != NULL ? clusterStorage.clusterCount : 0;
+        mergeLog.mergeCount = 0;
+        if (mergeLog.merges == NULL)
         {
-            finishProgram(fileRead, 1, srcFile, 0, 0);
-            prepareClusterArrForDeletion(tmpClusterArr, i);
+            finishProgram(afterRead, 1, 0, &clusterStorage, 0);
             return 1;
         }
+    }
 
-        // inits flow from tmp variables
-        flows[0] =  initFlow(flowID, totalBytes, flowDuration, packetCount, avgInterarrivalTime);
-
-        // creates cluster and appends it to temporary array
-        tmpClusterArr[i] = initCluster(flows, 1);
-
-        if (tmpClusterArr[i].flowCount == -1)
+    // starts uniting process (clusters which were not united have no ranges, so ranges are always freed)
+    int result = options.approxEps > 0 && destClusterCount != -1 ?
+        approximateClusters(destClusterCount, &clusterStorage, weights, options) :
+        clusterToNGroups(destClusterCount, &clusterStorage, weights, options);
+    if (result != 0)
+    {
+        if (result == 2)
         {
-            finishProgram(fileRead, 1, srcFile, 0, 0);
-            prepareClusterArrForDeletion(tmpClusterArr, i);
-            return 1;
+            fprintf(stderr, "ERROR: EPS is too small for features of flows\n");
+        }
+        if (result == 3)
+        {
+            fprintf(stderr, "ERROR: EPS is too big for wanted count of clusters\n");
         }
+        free(mergeLog.merges);
+        finishProgram(afterRead, result == 1, 0, &clusterStorage, 1);
+        return 1;
     }
-    // closes file
-    fclose(srcFile);
 
-    // returns results in form of cluster storage
-    *clusterStorage = initClusterStorage(tmpClusterArr, currClusterCount);
+    // prints out info about clusters
+    resultOut(stdout, clusterStorage, options);
+
+    if (options.exportPath != NULL && exportResult(options.exportPath, clusterStorage) != 0)
+    {
+        fprintf(stderr, "ERROR: Result could not be exported to %s\n", options.exportPath);
+        free(mergeLog.merges);
+        finishProgram(afterRead, 0, 0, &clusterStorage, 1);
+        return 1;
+    }
+    free(mergeLog.merges);
+    mergeLog.merges = NULL;
+
+    // finishes program (does all frees and exc.)
+    finishProgram(afterRead, 0, 0, &clusterStorage, 1);
 
     return 0;
 }
@@ -744,57 +7853,66 @@ int collectInfoFromSourceFile(FILE* srcFile, ClusterStorage *clusterStorage)
 // the place where every function's call starts
 int main(int argc, char* argv[])
 {
-    // inits weights united storage
-    Weights weights;
+    // stores optional arguments
+    Options options;
 
-    // stores destination cluster count
-    int destClusterCount;
-
-    if (collectInfoFromInput(argc, argv, &weights, &destClusterCount) == 1)
+    if (collectOptionsFromInput(&argc, argv, &options) == 1)
     {
         finishProgram(inputProcessing, 1, 0, 0, 0);
         return 1;
     }
+    isCollectingStats = options.printClusterStats;
 
-    // open file name of which was given
-    FILE* srcFile = fopen(argv[1], "r");
-
-    // if not opened not stops program with error
-    if (srcFile == NULL)
+#ifndef FLOWS_TRACE
+    if (options.tracePath != NULL)
     {
-        finishProgram(fileOpen, 1, 0, 0, 0);
+        fprintf(stderr, "ERROR: Tracing needs program compiled with -DFLOWS_TRACE\n");
         return 1;
     }
+#endif
+    startTrace();
 
-    // forms cluster storage from source file
-    ClusterStorage clusterStorage;
-
-    if (collectInfoFromSourceFile(srcFile, &clusterStorage) == 1)
-        return 1;
+    // large buffers are placed by policy from options, pool of workers touches them
+    startPlacement(options.placementPolicy, options.pageKind, options.printStats);
 
-    // checking if clusterCStorage was properly allocated
-    if (clusterStorage.clusterCount == -1)
+    // all parallel parts share one pool of workers
+    if (startScheduler(options.threadCount) != 0)
     {
-        finishProgram(afterRead, 1, srcFile, &clusterStorage, 0);
+        fprintf(stderr, "ERROR: Some allocation failed\n");
+        stopPlacement();
         return 1;
     }
 
-    // records if destinationClusterCount is same to initial cluster count
-    // for future memory management
-    bool isEqualCount = destClusterCount == clusterStorage.clusterCount;
-
-    // starts uniting process
-    if (uniteToNGroups(destClusterCount, &clusterStorage, weights) != 0)
+    // other modes are chosen by their name in place of file name
+    int result;
+    if (argc > 1 && strcmp(argv[1], "knn") == 0)
     {
-        finishProgram(afterRead, 1, 0, &clusterStorage, !isEqualCount);
-        return 1;
+        result = runNeighboursMode(argc, argv, options);
+    }
+    else if (argc > 1 && strcmp(argv[1], "batch") == 0)
+    {
+        result = runBatchMode(argc, argv, options);
+    }
+    else if (argc > 1 && strcmp(argv[1], "verify") == 0)
+    {
+        result = runVerifyMode(argc, argv, options);
+    }
+    else if (argc > 1 && strcmp(argv[1], "stream") == 0)
+    {
+        result = runStreamMode(argc, argv, options);
+    }
+    else
+    {
+        result = runClusteringMode(argc, argv, options);
     }
 
-    // prints out info about clusters
-    infoOut(clusterStorage);
-
-    // finishes program (does all frees and exc.)
-    finishProgram(afterRead, 0, srcFile, &clusterStorage, !isEqualCount && destClusterCount != -1);
+    stopScheduler(options.printStats);
+    stopPlacement();
 
-    return 0;
-}
\ No newline at end of file
+    if (options.tracePath != NULL && writeTrace(options.tracePath) != 0)
+    {
+        fprintf(stderr, "ERROR: Trace could not be written to %s\n", options.tracePath);
+        result = 1;
+    }
+    return result;
+}
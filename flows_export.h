@@ -0,0 +1,156 @@
+#ifndef FLOWS_EXPORT_H
+#define FLOWS_EXPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/** Binary export of flows clustering result
+ *
+ *  Written by `./flows FILENAME N WB WT WD WS --export PATH`, where PATH is
+ *  file name or "shm:/NAME" for POSIX shared memory object. Readers map it
+ *  and use arrays directly, nothing has to be parsed.
+ *
+ *  All numbers are in byte order of machine which wrote them, every array
+ *  starts at offset which is multiple of 8:
+ *
+ *  FlowsExportHeader
+ *  int32_t  assignment[flowCount]        - cluster of every flow, indexed by order of flows in input file
+ *  int32_t  clusterStarts[clusterCount+1] - first member of every cluster, last one is flowCount
+ *  int32_t  memberIDs[flowCount]          - flowIDs of members of all clusters, sorted by flowID inside cluster
+ *  int32_t  memberInputs[flowCount]       - input index of every member (same order as memberIDs)
+ *  FlowsExportMerge merges[mergeCount]    - merges in order they were done (only with --export-merges)
+ *
+ *  Clusters are numbered same way as in text output.
+ */
+
+#define FLOWS_EXPORT_MAGIC "FLOWSEXP"
+#define FLOWS_EXPORT_VERSION 1
+
+// structure at the start of exported result
+typedef struct SFlowsExportHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t totalSize;
+    int32_t flowCount;
+    int32_t clusterCount;
+    int32_t mergeCount;
+    int32_t reserved;
+    // offsets of arrays from start of export in bytes
+    uint64_t assignmentOffset;
+    uint64_t clusterStartsOffset;
+    uint64_t memberIDsOffset;
+    uint64_t memberInputsOffset;
+    uint64_t mergesOffset;
+}FlowsExportHeader;
+
+// structure for storing one merge, flows are the ones which linked united clusters
+typedef struct SFlowsExportMerge
+{
+    int32_t flowA;
+    int32_t flowB;
+    double range;
+}FlowsExportMerge;
+
+// structure for reading mapped export
+typedef struct SFlowsExport
+{
+    void* data;
+    size_t size;
+    const FlowsExportHeader* header;
+    const int32_t* assignment;
+    const int32_t* clusterStarts;
+    const int32_t* memberIDs;
+    const int32_t* memberInputs;
+    const FlowsExportMerge* merges;
+}FlowsExport;
+
+// returns offset of array placed after previous one, it is rounded up to multiple of 8
+static inline uint64_t flowsExportNextOffset(uint64_t offset, uint64_t size)
+{
+    return (offset + size + 7) & ~(uint64_t)7;
+}
+
+// opens file or shared memory object ("shm:/NAME") with export, returns -1 if it failed
+static inline int flowsExportOpenPath(const char* path, int flags, mode_t mode)
+{
+    if (strncmp(path, "shm:", 4) == 0)
+    {
+        return shm_open(path + 4, flags, mode);
+    }
+    return open(path, flags, mode);
+}
+
+// checks that array of count items of given size fits into export
+static inline bool flowsExportFits(const FlowsExport* result, uint64_t offset, int64_t count, uint64_t itemSize)
+{
+    return count >= 0 && offset % 8 == 0 && offset <= result->size &&
+        (uint64_t)count <= (result->size - offset)/itemSize;
+}
+
+// maps export for reading and checks its layout, returns 0 if it is ready to use
+static inline int flowsExportMap(const char* path, FlowsExport* result)
+{
+    int fd = flowsExportOpenPath(path, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        return 1;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(FlowsExportHeader))
+    {
+        close(fd);
+        return 1;
+    }
+    result->size = (size_t)info.st_size;
+    result->data = mmap(NULL, result->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (result->data == MAP_FAILED)
+    {
+        return 1;
+    }
+
+    const FlowsExportHeader* header = result->data;
+    const char* base = result->data;
+    result->header = header;
+    if (memcmp(header->magic, FLOWS_EXPORT_MAGIC, 8) != 0 || header->version != FLOWS_EXPORT_VERSION ||
+        header->totalSize != result->size ||
+        !flowsExportFits(result, header->assignmentOffset, header->flowCount, sizeof(int32_t)) ||
+        !flowsExportFits(result, header->clusterStartsOffset, (int64_t)header->clusterCount + 1, sizeof(int32_t)) ||
+        !flowsExportFits(result, header->memberIDsOffset, header->flowCount, sizeof(int32_t)) ||
+        !flowsExportFits(result, header->memberInputsOffset, header->flowCount, sizeof(int32_t)) ||
+        !flowsExportFits(result, header->mergesOffset, header->mergeCount, sizeof(FlowsExportMerge)))
+    {
+        munmap(result->data, result->size);
+        return 1;
+    }
+
+    result->assignment = (const int32_t*)(base + header->assignmentOffset);
+    result->clusterStarts = (const int32_t*)(base + header->clusterStartsOffset);
+    result->memberIDs = (const int32_t*)(base + header->memberIDsOffset);
+    result->memberInputs = (const int32_t*)(base + header->memberInputsOffset);
+    result->merges = (const FlowsExportMerge*)(base + header->mergesOffset);
+    return 0;
+}
+
+// returns number of members of cluster
+static inline int flowsExportClusterSize(const FlowsExport* result, int cluster)
+{
+    return result->clusterStarts[cluster + 1] - result->clusterStarts[cluster];
+}
+
+// unmaps export
+static inline void flowsExportUnmap(FlowsExport* result)
+{
+    munmap(result->data, result->size);
+    result->data = NULL;
+}
+
+#endif